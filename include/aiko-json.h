@@ -26,24 +26,124 @@ THE SOFTWARE.
 #ifndef __JSON_H__
 #define __JSON_H__
 
-#define JSON_THREAD_SAFE
+// Settings which change the layout of the structures below: a cmake build records them
+// in aiko-json-config.h, which sets them for programs using the library and rejects
+// different ones.
+#if defined(__has_include)
+	#if __has_include("aiko-json-config.h")
+		#include "aiko-json-config.h"
+	#endif
+#endif
 
+// Define JSON_THREAD_SAFE to let a parser or unparser lock itself from start...JSON()
+// to end...JSON(), so threads may share one. It needs pthread. Without it give every
+// thread its own parser and unparser, or share a parse read-only after freezeParsingJSON().
+#ifdef JSON_CONFIG_THREAD_SAFE
+	#if JSON_CONFIG_THREAD_SAFE && !defined(JSON_THREAD_SAFE)
+		#define JSON_THREAD_SAFE
+	#elif !JSON_CONFIG_THREAD_SAFE && defined(JSON_THREAD_SAFE)
+		#error "JSON_THREAD_SAFE is defined, but the library was built without it"
+	#endif
+#endif
 #ifdef JSON_THREAD_SAFE
 	#include <pthread.h>
 #endif
 
+// Define JSON_COMPACT_TOKENS for tokens of 16 instead of 24 bytes, see token_s.
+#ifdef JSON_CONFIG_COMPACT_TOKENS
+	#if JSON_CONFIG_COMPACT_TOKENS && !defined(JSON_COMPACT_TOKENS)
+		#define JSON_COMPACT_TOKENS
+	#elif !JSON_CONFIG_COMPACT_TOKENS && defined(JSON_COMPACT_TOKENS)
+		#error "JSON_COMPACT_TOKENS is defined, but the library was built without it"
+	#endif
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Define JSON_LARGE_DOCUMENTS to parse JSON of 2 GB and more: offsets and token
+// indexes become ptrdiff_t, which makes a token 48 instead of 24 bytes on 64 bit.
+#ifdef JSON_CONFIG_LARGE_DOCUMENTS
+	#if JSON_CONFIG_LARGE_DOCUMENTS && !defined(JSON_LARGE_DOCUMENTS)
+		#define JSON_LARGE_DOCUMENTS
+	#elif !JSON_CONFIG_LARGE_DOCUMENTS && defined(JSON_LARGE_DOCUMENTS)
+		#error "JSON_LARGE_DOCUMENTS is defined, but the library was built without it"
+	#endif
+#endif
+#ifdef JSON_LARGE_DOCUMENTS
+	#ifdef JSON_COMPACT_TOKENS
+		#error "JSON_LARGE_DOCUMENTS does not work with JSON_COMPACT_TOKENS"
+	#endif
+	typedef ptrdiff_t json_offset_t;
+#else
+	typedef int json_offset_t;
+#endif
+
+// Number of tokens allocated by the growth callback for a parser without tokens.
 #ifndef JSON_TOKEN_SIZE
-	#define JSON_TOKEN_SIZE (4096)
+	#define JSON_TOKEN_SIZE (256)
 #endif
 
+// Size of the output buffer allocated by the growth callback for an unparser without buffer.
 #ifndef JSON_JSON_SIZE
-	#define JSON_JSON_SIZE (65536)
+	#define JSON_JSON_SIZE (4096)
 #endif
 
 #ifndef JSON_STACK_DEPTH
 	#define JSON_STACK_DEPTH (32)
 #endif
 
+// Define JSON_NO_SIMD to build the scalar scanners only.
+
+// Objects with at least this many keys get a hash index on their first findKey().
+#ifndef JSON_KEY_INDEX_MIN
+	#define JSON_KEY_INDEX_MIN (16)
+#endif
+
+// Maximum number of segments and bytes of a compiled path.
+#ifndef JSON_PATH_DEPTH
+	#define JSON_PATH_DEPTH (16)
+#endif
+
+#ifndef JSON_PATH_SIZE
+	#define JSON_PATH_SIZE (256)
+#endif
+
+// Maximum number of keys and bytes of the key fragments of a compiled shape.
+#ifndef JSON_SHAPE_KEYS
+	#define JSON_SHAPE_KEYS (32)
+#endif
+
+#ifndef JSON_SHAPE_SIZE
+	#define JSON_SHAPE_SIZE (1024)
+#endif
+
+// Maximum nesting of objects and arrays while parsing.
+#ifndef JSON_PARSE_DEPTH
+	#define JSON_PARSE_DEPTH (128)
+#endif
+
+// Bytes of the chunks an arena requests from its growth callback.
+#ifndef JSON_ARENA_CHUNK
+	#define JSON_ARENA_CHUNK (16384)
+#endif
+
+// Number of parsers and of unparsers in a pool_s.
+#ifndef JSON_POOL_SIZE
+	#define JSON_POOL_SIZE (16)
+#endif
+
+// Maximum number of slices of a batch_s, which are tokenized in parallel.
+#ifndef JSON_BATCH_TASKS
+	#define JSON_BATCH_TASKS (64)
+#endif
+
+// Minimum bytes of NDJSON per slice of a batch_s.
+#ifndef JSON_BATCH_MIN
+	#define JSON_BATCH_MIN (65536)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -61,6 +161,23 @@ extern "C" {
 		JSON_STRING = 3
 	} djson_type_e;
 
+	typedef enum {
+		JSON_NODE_NULL = 0,
+		JSON_NODE_BOOLEAN = 1,
+		JSON_NODE_INTEGER = 2,	// a number without fraction and exponent which fits int64_t
+		JSON_NODE_NUMBER = 3,
+		JSON_NODE_STRING = 4,
+		JSON_NODE_ARRAY = 5,
+		JSON_NODE_OBJECT = 6
+	} djson_node_e;
+
+	// What transcodeJSON() does with a member or element after its hook.
+	typedef enum {
+		JSON_TRANSCODE_KEEP = 0,	// copy it
+		JSON_TRANSCODE_SKIP = 1,	// leave it out, e.g. because the hook wrote a replacement
+		JSON_TRANSCODE_ABORT = 2	// stop with JSON_ERROR_ABORTED
+	} djson_transcode_e;
+
 	typedef enum {
 		/* Not enough tokens were provided. */
 		JSON_ERROR_NOMEM = -1,
@@ -74,36 +191,108 @@ extern "C" {
 		JSON_ERROR_NOT_ARRAY = -5,
 		/* Tried to write Object key/value into Array. */
 		JSON_ERROR_NOT_OBJECT = -6,
-		/* Array/object nesting > JWR_STACK_DEPTH. */
+		/* Array/object nesting > JSON_STACK_DEPTH or JSON_PARSE_DEPTH. */
 		JSON_ERROR_STACK_FULL = -7,
 		/* Stack underflow error (too many 'end's). */
 		JSON_ERROR_STACK_EMPTY= -8,
 		/* Nesting error, not all objects closed when jsonClose() called. */
 		JSON_ERROR_NEST_ERROR = -9,
+		/* Flush callback of the unparser failed. */
+		JSON_ERROR_FLUSH = -10,
+		/* JSON longer than json_offset_t allows, see JSON_LARGE_DOCUMENTS. */
+		JSON_ERROR_TOO_LARGE = -11,
+		/* A callback of parseSAXJSON() or transcodeJSON() aborted. */
+		JSON_ERROR_ABORTED = -12,
 		/* Everything is ok. */
 		JSON_ERROR_OK = 0
 	} djson_error_e;
 
 
+#ifdef JSON_COMPACT_TOKENS
+	/*
+	 * 16 instead of 24 bytes per token, at most 2^28 - 2 tokens. Use the
+	 * tokenAt...() functions for everything but start and end.
+	 */
 	struct struct_token_s {
-		djson_type_e type;
 		int start;
 		int end;
-		int size;
-		int parent;
+		uint32_t info;	// parent + 1 in bits 0..27, type in bits 28..29, closed and skipped flags above
+		int count;		// strings: 1 for keys; objects and arrays: children while open, skip once closed
 	};
+#else
+	struct struct_token_s {
+		djson_type_e type;
+		json_offset_t start;
+		json_offset_t end;
+		json_offset_t size;
+		json_offset_t parent;
+		json_offset_t skip;		// objects and arrays: index of the first token after the subtree
+	};
+#endif
 	typedef struct struct_token_s token_s;
 
+	// Part of a JSON string, not terminated.
+	typedef struct {
+		const char *string;
+		size_t length;
+	} strview_s;
+
+	/*
+	 * realloc()-style allocator: returns a block of newSize bytes holding the
+	 * first oldSize bytes of ptr (which may be NULL), or NULL on failure.
+	 * A newSize of 0 releases ptr.
+	 */
+	typedef void *(*djson_realloc_f)(void *ctx, void *ptr, size_t oldSize, size_t newSize);
+
+	// Writes len bytes of output, returns 0 on success.
+	typedef int (*djson_flush_f)(void *ctx, const char *data, size_t len);
+
+	/*
+	 * Runs task(arg, i) for every i below count, on any threads and in any
+	 * order, and returns when all of them are done, e.g. by a thread pool.
+	 */
+	typedef void (*djson_task_f)(void *arg, size_t index);
+	typedef void (*djson_parallel_f)(void *ctx, size_t count, djson_task_f task, void *arg);
+
 	typedef struct {
 		djson_type_e nodeType;
 		int elementNo;
 	} nodestack_t;
 
+	/*
+	 * JSON tokenizer state, kept between calls of feedParsingJSON().
+	 */
+	typedef struct {
+		size_t pos; /* offset in the JSON string */
+		size_t toknext; /* next token to allocate */
+		json_offset_t toksuper; /* superior token node, e.g parent object or array */
+		json_offset_t stack[JSON_PARSE_DEPTH]; /* open objects and arrays, innermost last */
+		int depth; /* number of entries in stack */
+		int outer; /* open objects and arrays around pos which are not in stack */
+		size_t tokstop; /* stop when this many tokens exist, 0 for no limit */
+		bool feed; /* more input may follow, see feedParsingJSON() */
+	} jsmne_parser;
+
+	struct struct_keyentry_s;
+
 	struct struct_parser_s {
-		char *json;
+		const char *json;
+		size_t jsonLength;
 		size_t counter;
 		size_t length;
-		token_s tokens[JSON_TOKEN_SIZE];
+		token_s *tokens;					// token buffer of the application
+		size_t numTokens;					// number of tokens in buffer
+		djson_realloc_f growTokens;			// optional, enlarges the token buffer and key index
+		void *growContext;					// passed to growTokens
+		struct struct_keyentry_s *keyIndex;	// hash index of the keys of large objects
+		size_t keyIndexSize;				// number of entries in keyIndex
+		size_t keyIndexUsed;				// number of entries in use
+		jsmne_parser state;					// tokenizer position in json
+		bool isParsing;						// true between start/feed and endParsingJSON()
+		bool lazy;							// tokens are still created on demand
+		bool skipped;						// a lazy parse skipped contents of objects or arrays
+		bool frozen;						// after freezeParsingJSON(), no index is built
+		int error;							// result of tokenizing so far
 		#ifdef JSON_THREAD_SAFE
 		pthread_mutex_t mutex;
 		bool mutexInitialized;
@@ -111,7 +300,12 @@ extern "C" {
 	};
 
 	struct struct_unparser_s {
-		char buffer[JSON_JSON_SIZE];						// pointer to application's buffer
+		char *buffer;						// pointer to application's buffer
+		size_t size;						// size of buffer
+		djson_realloc_f growBuffer;			// optional, enlarges the buffer
+		void *growContext;					// passed to growBuffer
+		djson_flush_f flush;				// optional, gets the buffer when it is full
+		void *flushContext;					// passed to flush
 		char *bufp;							// current write position in buffer
 		char tmpbuf[32];					// local buffer for int/double convertions
 		int error;							// error code
@@ -119,59 +313,269 @@ extern "C" {
 		nodestack_t nodeStack[JSON_STACK_DEPTH];	// stack of array/object nodes
 		int stackpos;
 		int isPretty;						// 1= pretty output (inserts \n and spaces)
+		int escapeUnicode;					// 1= write non-ASCII characters as \uXXXX
+		bool isUnparsing;					// true between startUnparsingJSON() and endUnparsingJSON()
 		#ifdef JSON_THREAD_SAFE
 		pthread_mutex_t mutex;
 		bool mutexInitialized;
 		#endif
 	};
 
+	typedef struct {
+		size_t offset;						// key in buffer of path_s
+		size_t length;
+		uint32_t hash;
+		long index;							// array index, -1 if the key is no number
+	} pathsegment_t;
+
+	struct struct_path_s {
+		char buffer[JSON_PATH_SIZE];		// keys of all segments
+		pathsegment_t segments[JSON_PATH_DEPTH];
+		int count;
+	};
+
+	// Keys of objects which are written again and again with the same members.
+	struct struct_shape_s {
+		char buffer[JSON_SHAPE_SIZE];		// ,"key":  of all keys, escaped
+		size_t offsets[JSON_SHAPE_KEYS + 1];	// fragment i from offsets[i] to offsets[i + 1]
+		int count;
+	};
+
+	struct struct_pool_s {
+		struct struct_parser_s parsers[JSON_POOL_SIZE];
+		struct struct_unparser_s unparsers[JSON_POOL_SIZE];
+		long parserBusy[JSON_POOL_SIZE];	// 1 while acquired, changed atomically
+		long unparserBusy[JSON_POOL_SIZE];
+	};
+
+	// One line of NDJSON.
+	typedef struct {
+		const char *json;					// the line without line break
+		size_t length;
+		size_t firstToken;					// in the tokens of its slice
+		size_t numTokens;
+		int error;							// result of tokenizing
+	} batchrecord_t;
+
+	// Records of a slice of NDJSON, tokenized by one task.
+	typedef struct {
+		struct struct_parser_s parser;		// holds the tokens of all records
+		batchrecord_t *records;
+		size_t numRecords;
+		size_t recordSize;					// number of records allocated
+		size_t firstRecord;					// index of records[0] in the batch
+		const char *json;					// the slice, whole lines
+		size_t length;
+		int error;							// JSON_ERROR_NOMEM if not all records fit
+	} batchtask_t;
+
+	struct struct_batch_s {
+		batchtask_t tasks[JSON_BATCH_TASKS];
+		size_t numTasks;
+		size_t numRecords;
+		djson_parallel_f parallel;			// optional, runs the tasks
+		void *parallelContext;				// passed to parallel
+	};
+
+	/*
+	 * Callbacks of parseSAXJSON(), each may be NULL. Keys, strings and numbers
+	 * are spans of the JSON, escapes are not decoded. A non-zero result stops
+	 * the parse.
+	 */
+	struct struct_sax_s {
+		int (*onObjectStart)(void *ctx);
+		int (*onObjectEnd)(void *ctx);
+		int (*onArrayStart)(void *ctx);
+		int (*onArrayEnd)(void *ctx);
+		int (*onKey)(void *ctx, const char *key, size_t length);
+		int (*onString)(void *ctx, const char *value, size_t length);
+		int (*onNumber)(void *ctx, const char *value, size_t length);
+		int (*onBoolean)(void *ctx, bool value);
+		int (*onNull)(void *ctx);
+	};
+
+	/*
+	 * Bump allocator for DOM nodes: takes the application's buffer first,
+	 * then chunks from grow. Reset in O(1), chunks are kept for reuse.
+	 */
+	struct struct_chunk_s;
+	struct struct_arena_s {
+		char *buffer;						// application's buffer, may be NULL
+		size_t size;						// size of buffer
+		djson_realloc_f grow;				// optional, allocates further chunks
+		void *growContext;					// passed to grow
+		struct struct_chunk_s *chunks;		// chunks from grow
+		struct struct_chunk_s *chunk;		// chunk in use, NULL while in buffer
+		char *next;							// next free byte
+		char *end;							// end of the block in use
+	};
+
+	/*
+	 * A value of a DOM. Members of objects and elements of arrays follow each
+	 * other in memory, the next sibling of a node is node + 1.
+	 */
+	struct struct_node_s {
+		const char *key;					// decoded key of an object member, NULL otherwise
+		uint32_t keyLength;
+		uint32_t hash;						// hash of the key
+		djson_node_e type;
+		uint32_t count;						// members, elements or length of a string
+		union {
+			struct struct_node_s *children;	// array elements or object members
+			const char *string;				// decoded and NUL terminated
+			int64_t integer;
+			double number;
+			bool boolean;
+		} value;
+	};
+
 	typedef struct struct_parser_s parser_s;
 	typedef struct struct_unparser_s unparser_s;
+	typedef struct struct_path_s path_s;
+	typedef struct struct_shape_s shape_s;
+	typedef struct struct_pool_s pool_s;
+	typedef struct struct_batch_s batch_s;
+	typedef struct struct_sax_s sax_s;
+	typedef struct struct_arena_s arena_s;
+	typedef struct struct_node_s node_s;
+
+	/*
+	 * Called by transcodeJSON() with the key of every member or with every
+	 * element, may write members or elements itself. Returns a djson_transcode_e.
+	 */
+	typedef int (*djson_transcode_f)(void *ctx, unparser_s *unparser, parser_s *parser, size_t index);
 
 	// Helpers.
 	int getError(unparser_s *unparser);
 	char *errorToString(int err);
 
+	void *reallocJSON(void *ctx, void *ptr, size_t oldSize, size_t newSize);
+
 	// Parsing.
+	void initParsingJSON(parser_s *parser, token_s *tokens, size_t numTokens, djson_realloc_f growTokens, void *growContext);
+	void freeParsingJSON(parser_s *parser);
 	int startParsingJSON(parser_s *parser, char *js);
+	int startParsingJSONn(parser_s *parser, const char *js, size_t len);
+	int startParsingJSONLazy(parser_s *parser, const char *js, size_t len);
+	int feedParsingJSON(parser_s *parser, const char *js, size_t len);
+	int getParsingError(parser_s *parser);
+	int freezeParsingJSON(parser_s *parser);
 	int endParsingJSON(parser_s *parser);
 	bool hasBeforeToken(parser_s *parser);
 	bool hasCurrentToken(parser_s *parser);
 	bool hasNextToken(parser_s *parser);
 	bool tokenEqualString(parser_s *parser, char *s);
 	char *tokenToString(parser_s *parser);
+	strview_s tokenToView(parser_s *parser);
+	strview_s tokenAtToView(parser_s *parser, size_t index);
+	int tokenAtType(parser_s *parser, size_t index);
+	json_offset_t tokenAtSize(parser_s *parser, size_t index);
+	json_offset_t tokenAtParent(parser_s *parser, size_t index);
+	int tokenToInt64(parser_s *parser, int64_t *value);
+	int tokenToDouble(parser_s *parser, double *value);
+	int tokenToBool(parser_s *parser, bool *value);
+	json_offset_t findKey(parser_s *parser, size_t object, const char *key);
+	json_offset_t findKeyN(parser_s *parser, size_t object, const char *key, size_t length);
+	int compilePath(path_s *path, const char *expression);
+	json_offset_t evalPath(parser_s *parser, const path_s *path);
 	int beforeTokenType(parser_s *parser);
 	int currentTokenType(parser_s *parser);
 	int nextTokenType(parser_s *parser);
 	size_t sizeOfTokens(parser_s *parser);
 	void beforeToken(parser_s *parser);
 	void nextToken(parser_s *parser);
+	void skipToken(parser_s *parser);
+	bool nextSibling(parser_s *parser);
+
+	// DOM
+	void initArenaJSON(arena_s *arena, void *buffer, size_t size, djson_realloc_f grow, void *growContext);
+	void resetArenaJSON(arena_s *arena);
+	void freeArenaJSON(arena_s *arena);
+	int buildDOM(parser_s *parser, arena_s *arena, node_s **root);
+	const node_s *getMember(const node_s *object, const char *key);
+	const node_s *getMemberN(const node_s *object, const char *key, size_t length);
+	const node_s *getElement(const node_s *array, size_t index);
 
 	// Unparsing
+	void initUnparsingJSON(unparser_s *unparser, char *buffer, size_t size, djson_realloc_f growBuffer, void *growContext);
+	void freeUnparsingJSON(unparser_s *unparser);
+	void setUnparsingFlush(unparser_s *unparser, djson_flush_f flush, void *flushContext);
+	void setUnparsingEscapeUnicode(unparser_s *unparser, int oneOrZero);
 	int startUnparsingJSON(unparser_s *unparser, djson_type_e rootType, djson_format_e isPretty);
 	int endUnparsingJSON(unparser_s *unparser);
 
 	void addStringToObject(unparser_s *unparser, char *key, char *value);
 	void addIntegerToObject(unparser_s *unparser, char *key, int value);
+	void addInt64ToObject(unparser_s *unparser, char *key, int64_t value);
+	void addUInt64ToObject(unparser_s *unparser, char *key, uint64_t value);
 	void addDoubleToObject(unparser_s *unparser, char *key, double value);
+	void addFixedDoubleToObject(unparser_s *unparser, char *key, double value, int decimals);
 	void addBooleanToObject(unparser_s *unparser, char *key, int oneOrZero);
 	void addNullToObject(unparser_s *unparser, char *key);
 	void addObjectToObject(unparser_s *unparser, char *key);
 	void addArrayToObject(unparser_s *unparser, char *key);
 	void addStringToArray(unparser_s *unparser, char *value);
 	void addIntegerToArray(unparser_s *unparser, int value);
+	void addInt64ToArray(unparser_s *unparser, int64_t value);
+	void addUInt64ToArray(unparser_s *unparser, uint64_t value);
 	void addDoubleToArray(unparser_s *unparser, double value);
+	void addFixedDoubleToArray(unparser_s *unparser, double value, int decimals);
 	void addBooleanToArray(unparser_s *unparser, int oneOrZero);
 	void addNullToArray(unparser_s *unparser);
 	void addObjectToArray(unparser_s *unparser);
 	void addArrayToArray(unparser_s *unparser);
 	void addRawTextToObject(unparser_s *unparser, char *key, char *rawtext);
 	void addRawTextToArray(unparser_s *unparser, char *rawtext);
+	void addStringToObjectN(unparser_s *unparser, const char *key, size_t keylen, const char *value, size_t vallen);
+	void addStringToArrayN(unparser_s *unparser, const char *value, size_t vallen);
+	void addRawTextToObjectN(unparser_s *unparser, const char *key, size_t keylen, const char *rawtext, size_t len);
+	void addRawTextToArrayN(unparser_s *unparser, const char *rawtext, size_t len);
+	int compileShape(shape_s *shape, const char *const *keys, int count);
+	void addShapedToObject(unparser_s *unparser, char *key, const shape_s *shape, const node_s *values);
+	void addShapedToArray(unparser_s *unparser, const shape_s *shape, const node_s *values);
+	void addIntegerArrayToObject(unparser_s *unparser, char *key, const int *values, size_t n);
+	void addInt64ArrayToObject(unparser_s *unparser, char *key, const int64_t *values, size_t n);
+	void addDoubleArrayToObject(unparser_s *unparser, char *key, const double *values, size_t n);
+	void addBooleanArrayToObject(unparser_s *unparser, char *key, const bool *values, size_t n);
+	void addStringArrayToObject(unparser_s *unparser, char *key, const strview_s *values, size_t n);
+	void addIntegerArrayToArray(unparser_s *unparser, const int *values, size_t n);
+	void addInt64ArrayToArray(unparser_s *unparser, const int64_t *values, size_t n);
+	void addDoubleArrayToArray(unparser_s *unparser, const double *values, size_t n);
+	void addBooleanArrayToArray(unparser_s *unparser, const bool *values, size_t n);
+	void addStringArrayToArray(unparser_s *unparser, const strview_s *values, size_t n);
+	void addTokenToObject(unparser_s *unparser, char *key, parser_s *parser, size_t index);
+	void addTokenToArray(unparser_s *unparser, parser_s *parser, size_t index);
+	void addFormattedTokenToObject(unparser_s *unparser, char *key, parser_s *parser, size_t index);
+	void addFormattedTokenToArray(unparser_s *unparser, parser_s *parser, size_t index);
+	int transcodeJSON(unparser_s *unparser, parser_s *parser, size_t index, int reformat,
+			djson_transcode_f hook, void *ctx);
 	int endObject(unparser_s *unparser);
 	int endArray(unparser_s *unparser);
 	int endJSON(unparser_s *unparser);
 	char *getJSON(unparser_s *unparser);
 	size_t getJSONSize(unparser_s *unparser);
+	strview_s getJSONView(unparser_s *unparser);
+
+	// Pool
+	void initPoolJSON(pool_s *pool, djson_realloc_f grow, void *growContext);
+	void freePoolJSON(pool_s *pool);
+	parser_s *acquireParser(pool_s *pool);
+	void releaseParser(pool_s *pool, parser_s *parser);
+	unparser_s *acquireUnparser(pool_s *pool);
+	void releaseUnparser(pool_s *pool, unparser_s *unparser);
+
+	// Callbacks
+	int parseSAXJSON(const sax_s *sax, void *ctx, const char *js, size_t len);
+	bool isValidJSON(const char *js, size_t len);
+
+	// Batch
+	void initBatchJSON(batch_s *batch, djson_realloc_f grow, void *growContext,
+			djson_parallel_f parallel, void *parallelContext);
+	void freeBatchJSON(batch_s *batch);
+	int parseBatchJSON(batch_s *batch, const char *json, size_t length);
+	size_t sizeOfRecords(batch_s *batch);
+	int getRecordParser(batch_s *batch, size_t index, parser_s *parser);
+	int parseParallelJSON(batch_s *batch, parser_s *parser, const char *js, size_t len);
 
 #ifdef __cplusplus
 }
@@ -28,18 +28,221 @@ THE SOFTWARE.
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <stdio.h>
+#include <limits.h>
+#include <float.h>
+#include <assert.h>
 #include "aiko-json.h"
 
+/* Largest offset or token index a parse can hold. */
+#ifdef JSON_LARGE_DOCUMENTS
+	#define JSON_OFFSET_MAX PTRDIFF_MAX
+#else
+	#define JSON_OFFSET_MAX INT_MAX
+#endif
+
+/*
+ * Token fields, for both layouts. TOKEN_SIZE() is the size of strings and
+ * of open objects and arrays only, jsmne_size() that of closed ones.
+ */
+#ifdef JSON_COMPACT_TOKENS
+	#define TOKEN_PARENT_MASK		(0x0FFFFFFFu)
+	#define TOKEN_CLOSED			(1u << 30)
+	#define TOKEN_SKIPPED_FLAG		(1u << 31)
+	#define TOKEN_TYPE(t)			((djson_type_e) (((t)->info >> 28) & 3))
+	#define TOKEN_SET_TYPE(t, v)	((t)->info = ((t)->info & ~(3u << 28)) | ((uint32_t) (v) << 28))
+	#define TOKEN_PARENT(t)			((int) ((t)->info & TOKEN_PARENT_MASK) - 1)
+	#define TOKEN_SET_PARENT(t, v)	((t)->info = ((t)->info & ~TOKEN_PARENT_MASK) | (uint32_t) ((v) + 1))
+	#define TOKEN_SIZE(t)			((t)->count)
+	#define TOKEN_SKIP(t)			(((t)->info & TOKEN_CLOSED) ? (t)->count : -1)
+	#define TOKEN_CLOSE(t, v)		((t)->count = (v), (t)->info |= TOKEN_CLOSED)
+	#define TOKEN_SKIPPED(t)		(((t)->info & TOKEN_SKIPPED_FLAG) != 0)
+	#define TOKEN_SET_SKIPPED(t)	((t)->info |= TOKEN_SKIPPED_FLAG)
+	#define TOKEN_REOPEN(t, n)		((t)->count = (n), (t)->info &= ~(TOKEN_CLOSED | TOKEN_SKIPPED_FLAG))
+	#define TOKEN_RESET(t)			((t)->info = 0, (t)->count = 0)
+#else
+	#define TOKEN_TYPE(t)			((t)->type)
+	#define TOKEN_SET_TYPE(t, v)	((t)->type = (v))
+	#define TOKEN_PARENT(t)			((t)->parent)
+	#define TOKEN_SET_PARENT(t, v)	((t)->parent = (v))
+	#define TOKEN_SIZE(t)			((t)->size)
+	#define TOKEN_SKIP(t)			((t)->skip)
+	#define TOKEN_CLOSE(t, v)		((t)->skip = (v))
+	#define TOKEN_SKIPPED(t)		((t)->size < 0)
+	#define TOKEN_SET_SKIPPED(t)	((t)->size = -1)
+	#define TOKEN_REOPEN(t, n)		((t)->size = (n), (t)->skip = -1)
+	#define TOKEN_RESET(t)			((t)->size = 0, (t)->parent = -1, (t)->skip = -1)
+#endif
+
+#if !defined(JSON_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#include <emmintrin.h>
+	#define JSON_SIMD_SSE2
+#elif !defined(JSON_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+	#include <arm_neon.h>
+	#define JSON_SIMD_NEON
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
 /**
- * JSON parser. Contains an array of token blocks available. Also stores
- * the string being parsed now and current position in that string
+ * Number of trailing zero bits, mask must not be 0.
  */
-typedef struct {
-	unsigned int pos; /* offset in the JSON string */
-	unsigned int toknext; /* next token to allocate */
-	int toksuper; /* superior token node, e.g parent object or array */
-} jsmne_parser;
+static unsigned int jsmne_ctz(uint64_t mask) {
+	#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long i;
+	_BitScanForward64(&i, mask);
+	return i;
+	#elif defined(_MSC_VER)
+	unsigned long i;
+	if (_BitScanForward(&i, (unsigned long) mask)) return i;
+	_BitScanForward(&i, (unsigned long) (mask >> 32));
+	return i + 32;
+	#else
+	return __builtin_ctzll(mask);
+	#endif
+}
+
+/**
+ * Returns the offset of the next '"' or '\\' at or after pos, or len.
+ * Ordinary string characters are skipped 16 bytes at a time.
+ */
+static size_t jsmne_find_string_end(const char *js, size_t pos, size_t len) {
+	#if defined(JSON_SIMD_SSE2)
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	for (; pos + 16 <= len; pos += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (js + pos));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+		if (mask != 0) {
+			return pos + jsmne_ctz(mask);
+		}
+	}
+	#elif defined(JSON_SIMD_NEON)
+	const uint8x16_t quote = vdupq_n_u8('\"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	for (; pos + 16 <= len; pos += 16) {
+		uint8x16_t chunk = vld1q_u8((const uint8_t *) (js + pos));
+		uint8x16_t match = vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash));
+		/* 4 bits per byte */
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+				vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+		if (mask != 0) {
+			return pos + (jsmne_ctz(mask) >> 2);
+		}
+	}
+	#endif
+	for (; pos < len; pos++) {
+		if (js[pos] == '\"' || js[pos] == '\\') {
+			break;
+		}
+	}
+	return pos;
+}
+
+/*
+ * Quotes, backslashes and brackets, with comma set commas too, among the
+ * first 16 bytes (or len if less) at p: byte i sets bit i * JSON_MASK_STEP.
+ * Bytes below 32 may be set as well.
+ */
+#if defined(JSON_SIMD_NEON)
+	#define JSON_MASK_STEP 4
+#else
+	#define JSON_MASK_STEP 1
+#endif
+
+static uint64_t jsmne_structural_mask(const char *p, size_t len, bool comma) {
+	uint64_t mask = 0;
+	size_t i;
+	#if defined(JSON_SIMD_SSE2)
+	if (len >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) p);
+		/* '[' and ']' become '{' and '}' */
+		__m128i folded = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+		__m128i match = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+				_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('\"')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))));
+		if (comma) {
+			match = _mm_or_si128(match, _mm_cmpeq_epi8(folded, _mm_set1_epi8(',')));
+		}
+		return (uint64_t) (unsigned int) _mm_movemask_epi8(match);
+	}
+	#elif defined(JSON_SIMD_NEON)
+	if (len >= 16) {
+		uint8x16_t chunk = vld1q_u8((const uint8_t *) p);
+		uint8x16_t folded = vorrq_u8(chunk, vdupq_n_u8(0x20));
+		uint8x16_t match = vorrq_u8(
+				vorrq_u8(vceqq_u8(folded, vdupq_n_u8('{')), vceqq_u8(folded, vdupq_n_u8('}'))),
+				vorrq_u8(vceqq_u8(folded, vdupq_n_u8('\"')), vceqq_u8(chunk, vdupq_n_u8('\\'))));
+		if (comma) {
+			match = vorrq_u8(match, vceqq_u8(folded, vdupq_n_u8(',')));
+		}
+		/* One bit of each nibble */
+		return vget_lane_u64(vreinterpret_u64_u8(
+				vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0) & 0x1111111111111111ULL;
+	}
+	#endif
+	for (i = 0; i < len && i < 16; i++) {
+		char c = p[i];
+		if (c == '\"' || c == '\\' || c == '{' || c == '}' || c == '[' || c == ']' || (comma && c == ',')) {
+			mask |= (uint64_t) 1 << (i * JSON_MASK_STEP);
+		}
+	}
+	return mask;
+}
+
+/**
+ * Returns the offset of the first non whitespace character at or after pos, or len.
+ */
+static size_t jsmne_skip_space(const char *js, size_t pos, size_t len) {
+	/* Mostly a single space or none at all */
+	if (pos + 1 >= len || (js[pos + 1] != ' ' && js[pos + 1] != '\n' &&
+			js[pos + 1] != '\t' && js[pos + 1] != '\r')) {
+		return pos + 1;
+	}
+	#if defined(JSON_SIMD_SSE2)
+	for (; pos + 16 <= len; pos += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (js + pos));
+		__m128i space = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+		unsigned int mask = ~(unsigned int) _mm_movemask_epi8(space) & 0xFFFF;
+		if (mask != 0) {
+			return pos + jsmne_ctz(mask);
+		}
+	}
+	#elif defined(JSON_SIMD_NEON)
+	for (; pos + 16 <= len; pos += 16) {
+		uint8x16_t chunk = vld1q_u8((const uint8_t *) (js + pos));
+		uint8x16_t space = vorrq_u8(
+				vorrq_u8(vceqq_u8(chunk, vdupq_n_u8(' ')), vceqq_u8(chunk, vdupq_n_u8('\n'))),
+				vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('\t')), vceqq_u8(chunk, vdupq_n_u8('\r'))));
+		uint64_t mask = ~vget_lane_u64(vreinterpret_u64_u8(
+				vshrn_n_u16(vreinterpretq_u16_u8(space), 4)), 0);
+		if (mask != 0) {
+			return pos + (jsmne_ctz(mask) >> 2);
+		}
+	}
+	#endif
+	for (; pos < len; pos++) {
+		if (js[pos] != ' ' && js[pos] != '\n' && js[pos] != '\t' && js[pos] != '\r') {
+			break;
+		}
+	}
+	return pos;
+}
+
+/*
+ * Entry of the key index. A table holds the keys of all indexed objects,
+ * an entry with key -1 marks an object as indexed. key is the token index
+ * plus 1, so a zeroed entry is free.
+ */
+struct struct_keyentry_s {
+	json_offset_t object;
+	json_offset_t key;
+	uint32_t hash;
+};
 
 /**
  * Allocates a fresh unused token from the token pull.
@@ -50,10 +253,14 @@ static token_s *jsmne_alloc_token(jsmne_parser *parser,
 	if (parser->toknext >= num_tokens) {
 		return NULL;
 	}
+	#ifdef JSON_COMPACT_TOKENS
+	if (parser->toknext >= TOKEN_PARENT_MASK - 1) {
+		return NULL;
+	}
+	#endif
 	tok = &tokens[parser->toknext++];
 	tok->start = tok->end = -1;
-	tok->size = 0;
-	tok->parent = -1;
+	TOKEN_RESET(tok);
 	return tok;
 }
 
@@ -61,198 +268,227 @@ static token_s *jsmne_alloc_token(jsmne_parser *parser,
  * Fills token type and boundaries.
  */
 static void jsmne_fill_token(token_s *token, djson_type_e type,
-                            int start, int end) {
-	token->type = type;
+                            json_offset_t start, json_offset_t end) {
+	TOKEN_SET_TYPE(token, type);
 	token->start = start;
 	token->end = end;
-	token->size = 0;
 }
 
 /**
- * Fills next available token with JSON primitive.
+ * Finds the end of a primitive starting at pos: the offset of the next
+ * delimiter, or len.
  */
-static djson_error_e jsmne_parse_primitive(jsmne_parser *parser, const char *js,
-		size_t len, token_s *tokens, size_t num_tokens) {
-	token_s *token;
-	int start;
-
-	start = parser->pos;
-
-	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
-		switch (js[parser->pos]) {
+static djson_error_e jsmne_scan_primitive(const char *js, size_t pos, size_t len, size_t *end) {
+	for (; pos < len; pos++) {
+		switch (js[pos]) {
 			case '\t' : case '\r' : case '\n' : case ' ' :
 			case ','  : case ']'  : case '}' :
-				goto found;
+				*end = pos;
+				return JSON_ERROR_OK;
 		}
-		if (js[parser->pos] < 32 || js[parser->pos] >= 127) {
-			parser->pos = start;
+		if (js[pos] < 32 || js[pos] >= 127) {
 			return JSON_ERROR_INVAL;
 		}
 	}
+	*end = len;
+	return JSON_ERROR_OK;
+}
 
-found:
-	if (tokens == NULL) {
-		parser->pos--;
-		return 0;
+/**
+ * Fills next available token with JSON primitive.
+ */
+static djson_error_e jsmne_parse_primitive(jsmne_parser *parser, const char *js,
+		size_t len, token_s *tokens, size_t num_tokens) {
+	token_s *token;
+	size_t end;
+
+	if (jsmne_scan_primitive(js, parser->pos, len, &end) != JSON_ERROR_OK) {
+		return JSON_ERROR_INVAL;
+	}
+	/* Primitive inside an object or array, or any while feeding, may continue in the next chunk */
+	if (end >= len && (parser->toksuper != -1 || parser->feed)) {
+		return JSON_ERROR_PART;
 	}
 	token = jsmne_alloc_token(parser, tokens, num_tokens);
 	if (token == NULL) {
-		parser->pos = start;
 		return JSON_ERROR_NOMEM;
 	}
-	jsmne_fill_token(token, JSON_PRIMITIVE, start, parser->pos);
-	token->parent = parser->toksuper;
-	parser->pos--;
+	jsmne_fill_token(token, JSON_PRIMITIVE, (json_offset_t) parser->pos, (json_offset_t) end);
+	TOKEN_SET_PARENT(token, parser->toksuper);
+	parser->pos = end - 1;
 	return 0;
 }
 
 /**
- * Filsl next token with JSON string.
+ * Finds the closing quote of a string whose opening quote is at pos and
+ * checks its escapes.
  */
-static djson_error_e jsmne_parse_string(jsmne_parser *parser, const char *js,
-		size_t len, token_s *tokens, size_t num_tokens) {
-	token_s *token;
-
-	int start = parser->pos;
-
-	parser->pos++;
-
+static djson_error_e jsmne_scan_string(const char *js, size_t pos, size_t len, size_t *end) {
 	/* Skip starting quote */
-	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
-		char c = js[parser->pos];
+	for (pos++; pos < len; pos++) {
+		char c;
+
+		pos = jsmne_find_string_end(js, pos, len);
+		if (pos >= len) {
+			break;
+		}
+		c = js[pos];
 
 		/* Quote: end of string */
 		if (c == '\"') {
-			if (tokens == NULL) {
-				return 0;
-			}
-			token = jsmne_alloc_token(parser, tokens, num_tokens);
-			if (token == NULL) {
-				parser->pos = start;
-				return JSON_ERROR_NOMEM;
-			}
-			jsmne_fill_token(token, JSON_STRING, start+1, parser->pos);
-			token->parent = parser->toksuper;
-			return 0;
+			*end = pos;
+			return JSON_ERROR_OK;
 		}
 
 		/* Backslash: Quoted symbol expected */
-		if (c == '\\' && parser->pos + 1 < len) {
+		if (c == '\\' && pos + 1 < len) {
 			int i;
-			parser->pos++;
-			switch (js[parser->pos]) {
+			pos++;
+			switch (js[pos]) {
 				/* Allowed escaped symbols */
 				case '\"': case '/' : case '\\' : case 'b' :
 				case 'f' : case 'r' : case 'n'  : case 't' :
 					break;
 				/* Allows escaped symbol \uXXXX */
 				case 'u':
-					parser->pos++;
-					for(i = 0; i < 4 && parser->pos < len && js[parser->pos] != '\0'; i++) {
+					pos++;
+					for(i = 0; i < 4 && pos < len; i++) {
 						/* If it isn't a hex character we have an error */
-						if(!((js[parser->pos] >= 48 && js[parser->pos] <= 57) || /* 0-9 */
-									(js[parser->pos] >= 65 && js[parser->pos] <= 70) || /* A-F */
-									(js[parser->pos] >= 97 && js[parser->pos] <= 102))) { /* a-f */
-							parser->pos = start;
+						if(!((js[pos] >= 48 && js[pos] <= 57) || /* 0-9 */
+									(js[pos] >= 65 && js[pos] <= 70) || /* A-F */
+									(js[pos] >= 97 && js[pos] <= 102))) { /* a-f */
 							return JSON_ERROR_INVAL;
 						}
-						parser->pos++;
+						pos++;
 					}
-					parser->pos--;
+					pos--;
 					break;
 				/* Unexpected symbol */
 				default:
-					parser->pos = start;
 					return JSON_ERROR_INVAL;
 			}
 		}
 	}
-	parser->pos = start;
 	return JSON_ERROR_PART;
 }
 
+/**
+ * Returns true if the bytes from pos up to end hold one below 0x20, which
+ * JSON strings may only contain escaped. Only the validating parsers check
+ * this, the tokenizer doesn't.
+ */
+static bool jsmne_has_control(const char *js, size_t pos, size_t end) {
+	#if defined(JSON_SIMD_SSE2)
+	const __m128i limit = _mm_set1_epi8(0x1F);
+	for (; pos + 16 <= end; pos += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (js + pos));
+		/* Unsigned chunk <= 0x1F */
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk, limit), limit)) != 0) {
+			return true;
+		}
+	}
+	#elif defined(JSON_SIMD_NEON)
+	for (; pos + 16 <= end; pos += 16) {
+		uint8x16_t chunk = vld1q_u8((const uint8_t *) (js + pos));
+		if (vmaxvq_u8(vcltq_u8(chunk, vdupq_n_u8(0x20))) != 0) {
+			return true;
+		}
+	}
+	#endif
+	for (; pos < end; pos++) {
+		if ((unsigned char) js[pos] < 0x20) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Filsl next token with JSON string.
+ */
+static djson_error_e jsmne_parse_string(jsmne_parser *parser, const char *js,
+		size_t len, token_s *tokens, size_t num_tokens) {
+	token_s *token;
+	size_t end;
+	djson_error_e r = jsmne_scan_string(js, parser->pos, len, &end);
+
+	if (r != JSON_ERROR_OK) {
+		return r;
+	}
+	token = jsmne_alloc_token(parser, tokens, num_tokens);
+	if (token == NULL) {
+		return JSON_ERROR_NOMEM;
+	}
+	jsmne_fill_token(token, JSON_STRING, (json_offset_t) parser->pos + 1, (json_offset_t) end);
+	TOKEN_SET_PARENT(token, parser->toksuper);
+	parser->pos = end;
+	return 0;
+}
+
 /**
  * Parse JSON string and fill tokens.
  */
-static djson_error_e jsmne_parse(jsmne_parser *parser, const char *js, size_t len,
-		token_s *tokens, unsigned int num_tokens) {
+static json_offset_t jsmne_parse(jsmne_parser *parser, const char *js, size_t len,
+		token_s *tokens, size_t num_tokens) {
 	djson_error_e r;
-	int i;
 	token_s *token;
-	int count = 0;
-    int k = 0;
 
-	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
+	for (; parser->pos < len; parser->pos++) {
 		char c;
 		djson_type_e type;
 
+		/* Lazy parsing: enough tokens for now */
+		if (parser->tokstop != 0 && parser->toknext >= parser->tokstop) {
+			return (json_offset_t) parser->toknext;
+		}
+
 		c = js[parser->pos];
 		switch (c) {
 			case '{': case '[':
-				count++;
-				if (tokens == NULL) {
-					break;
+				if (parser->outer + parser->depth >= JSON_PARSE_DEPTH) {
+					return JSON_ERROR_STACK_FULL;
 				}
-				token = jsmne_alloc_token(parser, tokens, num_tokens); k++;
+				token = jsmne_alloc_token(parser, tokens, num_tokens);
 				if (token == NULL)
 					return JSON_ERROR_NOMEM;
 				if (parser->toksuper != -1) {
-					tokens[parser->toksuper].size++;
-					token->parent = parser->toksuper;
+					TOKEN_SIZE(&tokens[parser->toksuper])++;
+					TOKEN_SET_PARENT(token, parser->toksuper);
 				}
-				token->type = (c == '{' ? JSON_OBJECT : JSON_ARRAY);
-				token->start = parser->pos;
-				parser->toksuper = parser->toknext - 1;
+				TOKEN_SET_TYPE(token, (c == '{' ? JSON_OBJECT : JSON_ARRAY));
+				token->start = (json_offset_t) parser->pos;
+				parser->toksuper = (json_offset_t) parser->toknext - 1;
+				parser->stack[parser->depth++] = parser->toksuper;
 				break;
 			case '}': case ']':
-				if (tokens == NULL)
-					break;
 				type = (c == '}' ? JSON_OBJECT : JSON_ARRAY);
-				if (parser->toknext < 1) {
+				/* Innermost open object or array is on top of the stack */
+				if (parser->depth == 0) {
 					return JSON_ERROR_INVAL;
 				}
-				token = &tokens[parser->toknext - 1];
-				for (;;) {
-					if (token->start != -1 && token->end == -1) {
-						if (token->type != type) {
-							return JSON_ERROR_INVAL;
-						}
-						token->end = parser->pos + 1;
-						parser->toksuper = token->parent;
-						break;
-					}
-					if (token->parent == -1) {
-						break;
-					}
-					token = &tokens[token->parent];
+				token = &tokens[parser->stack[parser->depth - 1]];
+				if (TOKEN_TYPE(token) != type) {
+					return JSON_ERROR_INVAL;
 				}
+				token->end = (json_offset_t) parser->pos + 1;
+				TOKEN_CLOSE(token, (json_offset_t) parser->toknext);
+				parser->depth--;
+				parser->toksuper = (parser->depth > 0) ? parser->stack[parser->depth - 1] : -1;
 				break;
 			case '\"':
-				r = jsmne_parse_string(parser, js, len, tokens, num_tokens); k++;
+				r = jsmne_parse_string(parser, js, len, tokens, num_tokens);
 				if (r < 0) return r;
-				count++;
-				if (parser->toksuper != -1 && tokens != NULL)
-					tokens[parser->toksuper].size++;
+				if (parser->toksuper != -1)
+					TOKEN_SIZE(&tokens[parser->toksuper])++;
 				break;
 			case '\t' : case '\r' : case '\n' : case ' ':
+				parser->pos = jsmne_skip_space(js, parser->pos, len) - 1;
 				break;
 			case ':':
-				parser->toksuper = parser->toknext - 1;
+				parser->toksuper = (json_offset_t) parser->toknext - 1;
 				break;
 			case ',':
-				if (tokens != NULL &&
-						tokens[parser->toksuper].type != JSON_ARRAY &&
-						tokens[parser->toksuper].type != JSON_OBJECT) {
-					parser->toksuper = tokens[parser->toksuper].parent;
-					for (i = parser->toknext - 1; i >= 0; i--) {
-						if (tokens[i].type == JSON_ARRAY || tokens[i].type == JSON_OBJECT) {
-							if (tokens[i].start != -1 && tokens[i].end == -1) {
-								parser->toksuper = i;
-								break;
-							}
-						}
-					}
-				}
+				parser->toksuper = (parser->depth > 0) ? parser->stack[parser->depth - 1] : -1;
 				break;
 
 			/* In strict mode primitives are: numbers and booleans */
@@ -260,20 +496,19 @@ static djson_error_e jsmne_parse(jsmne_parser *parser, const char *js, size_t le
 			case '5': case '6': case '7' : case '8': case '9':
 			case 't': case 'f': case 'n' :
 				/* And they must not be keys of the object */
-				if (tokens != NULL) {
+				if (parser->toksuper != -1) {
 					token_s *t = &tokens[parser->toksuper];
-					if (t->type == JSON_OBJECT ||
-							(t->type == JSON_STRING && t->size != 0)) {
+					if (TOKEN_TYPE(t) == JSON_OBJECT ||
+							(TOKEN_TYPE(t) == JSON_STRING && TOKEN_SIZE(t) != 0)) {
 						return JSON_ERROR_INVAL;
 					}
 				}
-				r = jsmne_parse_primitive(parser, js, len, tokens, num_tokens); k++;
+				r = jsmne_parse_primitive(parser, js, len, tokens, num_tokens);
 				if (r < 0) {
                     return r;
                 }
-				count++;
-				if (parser->toksuper != -1 && tokens != NULL)
-					tokens[parser->toksuper].size++;
+				if (parser->toksuper != -1)
+					TOKEN_SIZE(&tokens[parser->toksuper])++;
 				break;
 
 			/* Unexpected char in strict mode */
@@ -282,13 +517,11 @@ static djson_error_e jsmne_parse(jsmne_parser *parser, const char *js, size_t le
 		}
 	}
 
-	for (i = parser->toknext - 1; i >= 0; i--) {
-		/* Unmatched opened object or array */
-		if (tokens[i].start != -1 && tokens[i].end == -1) {
-			return JSON_ERROR_PART;
-		}
+	/* Unmatched opened object or array */
+	if (parser->depth > 0) {
+		return JSON_ERROR_PART;
 	}
-	return k;
+	return (json_offset_t) parser->toknext;
 }
 
 /**
@@ -299,6 +532,31 @@ static void jsmne_init(jsmne_parser *parser) {
 	parser->pos = 0;
 	parser->toknext = 0;
 	parser->toksuper = -1;
+	parser->depth = 0;
+	parser->outer = 0;
+	parser->tokstop = 0;
+	parser->feed = false;
+}
+
+/**
+ * Enlarges the token buffer of the parser with its growth callback.
+ */
+static bool jsmne_grow_tokens(parser_s *parser) {
+	size_t num;
+	token_s *tokens;
+
+	if (parser->growTokens == NULL) {
+		return false;
+	}
+	num = (parser->numTokens > 0) ? parser->numTokens * 2 : JSON_TOKEN_SIZE;
+	tokens = parser->growTokens(parser->growContext, parser->tokens,
+			parser->numTokens * sizeof(token_s), num * sizeof(token_s));
+	if (tokens == NULL) {
+		return false;
+	}
+	parser->tokens = tokens;
+	parser->numTokens = num;
+	return true;
 }
 
 static void strreverse(char* begin, char* end) {
@@ -307,17 +565,271 @@ static void strreverse(char* begin, char* end) {
         aux = *end, *end-- = *begin, *begin++ = aux;
 }
 
-static void modp_itoa10(int32_t value, char* str) {
-    char* wstr=str;
-    // Take care of sign
-    unsigned int uvalue = (value < 0) ? -value : value;
-    // Conversion. Number is reversed.
-    do *wstr++ = (char)(48 + (uvalue % 10)); while(uvalue /= 10);
-    if (value < 0) *wstr++ = '-';
-    *wstr='\0';
+/*
+ * Shortest double to string conversion which reads back to the same value,
+ * after the Grisu2 algorithm of Florian Loitsch ("Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", PLDI 2010) in the layout
+ * of Milo Yip's dtoa.
+ */
+typedef struct {
+	uint64_t f;
+	int e;
+} grisu_fp_t;
+
+static const uint64_t grisu_powers_f[] = {
+	0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+	0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+	0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+	0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+	0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+	0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+	0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+	0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+	0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+	0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+	0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+	0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+	0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+	0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+	0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+	0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+	0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+	0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+	0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+	0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+	0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+	0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+	0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+	0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+	0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+	0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+	0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+	0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+	0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t grisu_powers_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+	-901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+	-582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+	-263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+	56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+	694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+	1013, 1039, 1066
+};
+
+static const uint64_t grisu_pow10[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+	100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+	10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static grisu_fp_t grisu_mul(grisu_fp_t x, grisu_fp_t y) {
+	grisu_fp_t r;
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 p = (unsigned __int128) x.f * y.f;
+	r.f = (uint64_t) (p >> 64) + (((uint64_t) p >> 63) & 1);
+#else
+	const uint64_t M32 = 0xFFFFFFFFULL;
+	uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32) + (1ULL << 31);
+	r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+#endif
+	r.e = x.e + y.e + 64;
+	return r;
+}
+
+static grisu_fp_t grisu_normalize(grisu_fp_t x) {
+	while (!(x.f & (1ULL << 63))) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+static void grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+			(rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+		buffer[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+static int grisu_digits(const grisu_fp_t *w, const grisu_fp_t *mp, uint64_t delta, char *buffer, int *k) {
+	const int shift = -mp->e;
+	const uint64_t one = 1ULL << shift;
+	const uint64_t wp_w = mp->f - w->f;
+	uint32_t p1 = (uint32_t) (mp->f >> shift);
+	uint64_t p2 = mp->f & (one - 1);
+	int kappa = 1, len = 0;
+
+	while (kappa < 10 && p1 >= grisu_pow10[kappa]) kappa++;
+	while (kappa > 0) {
+		uint32_t d;
+		switch (kappa) {
+			case 10: d = p1 / 1000000000; p1 %= 1000000000; break;
+			case  9: d = p1 /  100000000; p1 %=  100000000; break;
+			case  8: d = p1 /   10000000; p1 %=   10000000; break;
+			case  7: d = p1 /    1000000; p1 %=    1000000; break;
+			case  6: d = p1 /     100000; p1 %=     100000; break;
+			case  5: d = p1 /      10000; p1 %=      10000; break;
+			case  4: d = p1 /       1000; p1 %=       1000; break;
+			case  3: d = p1 /        100; p1 %=        100; break;
+			case  2: d = p1 /         10; p1 %=         10; break;
+			default: d = p1;              p1 =           0; break;
+		}
+		if (d || len) buffer[len++] = (char) ('0' + d);
+		kappa--;
+		uint64_t rest = ((uint64_t) p1 << shift) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			grisu_round(buffer, len, delta, rest, grisu_pow10[kappa] << shift, wp_w);
+			return len;
+		}
+	}
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		char d = (char) (p2 >> shift);
+		if (d || len) buffer[len++] = (char) ('0' + d);
+		p2 &= one - 1;
+		kappa--;
+		if (p2 < delta) {
+			*k += kappa;
+			grisu_round(buffer, len, delta, p2, one, (-kappa < 20) ? wp_w * grisu_pow10[-kappa] : 0);
+			return len;
+		}
+	}
+}
+
+/**
+ * Writes the shortest digits of a positive, finite value to buffer, with
+ * value = digits * 10^k. Returns the number of digits.
+ */
+static int grisu2(double value, char *buffer, int *k) {
+	uint64_t bits;
+	grisu_fp_t v, plus, minus, c, w;
+	memcpy(&bits, &value, sizeof(bits));
 
-    // Reverse string
-    strreverse(str,wstr-1);
+	uint64_t significand = bits & 0x000FFFFFFFFFFFFFULL;
+	int biased = (int) ((bits >> 52) & 0x7FF);
+	if (biased != 0) {
+		v.f = significand | 0x0010000000000000ULL;
+		v.e = biased - 1075;
+	} else {
+		v.f = significand;
+		v.e = -1074;
+	}
+
+	/* boundaries m+ and m- halfway to the neighbouring doubles */
+	plus.f = (v.f << 1) + 1;
+	plus.e = v.e - 1;
+	while (!(plus.f & (0x0010000000000000ULL << 1))) {
+		plus.f <<= 1;
+		plus.e--;
+	}
+	plus.f <<= 10;
+	plus.e -= 10;
+	if (v.f == 0x0010000000000000ULL) {
+		minus.f = (v.f << 2) - 1;
+		minus.e = v.e - 2;
+	} else {
+		minus.f = (v.f << 1) - 1;
+		minus.e = v.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	/* cached power c = 10^-k which brings the exponent into [-60, -32] */
+	double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+	int ik = (int) dk;
+	if (dk - ik > 0.0) ik++;
+	unsigned int index = (unsigned int) ((ik >> 3) + 1);
+	*k = -(-348 + (int) index * 8);
+	c.f = grisu_powers_f[index];
+	c.e = grisu_powers_e[index];
+
+	w = grisu_mul(grisu_normalize(v), c);
+	plus = grisu_mul(plus, c);
+	minus = grisu_mul(minus, c);
+	minus.f++;
+	plus.f--;
+	return grisu_digits(&w, &plus, plus.f - minus.f, buffer, k);
+}
+
+static char *grisu_exponent(int k, char *str) {
+	*str++ = 'e';
+	if (k < 0) {
+		*str++ = '-';
+		k = -k;
+	}
+	if (k >= 100) {
+		*str++ = (char) ('0' + k / 100);
+		k %= 100;
+		*str++ = (char) ('0' + k / 10);
+	} else if (k >= 10) {
+		*str++ = (char) ('0' + k / 10);
+	}
+	*str++ = (char) ('0' + k % 10);
+	return str;
+}
+
+/**
+ * Formats value with as few digits as needed to read it back exactly.
+ * Integral values have no fraction, NaN and infinity become null.
+ * str needs room for 26 bytes.
+ */
+static void grisu_dtoa(double value, char *str) {
+	uint64_t bits;
+	int len, k, kk, i;
+	memcpy(&bits, &value, sizeof(bits));
+
+	if ((bits & 0x7FF0000000000000ULL) == 0x7FF0000000000000ULL) {
+		memcpy(str, "null", 5);
+		return;
+	}
+	if (bits >> 63) {
+		*str++ = '-';
+		value = -value;
+	}
+	if (value == 0) {
+		str[0] = '0';
+		str[1] = '\0';
+		return;
+	}
+
+	len = grisu2(value, str, &k);
+	kk = len + k;	/* 10^(kk-1) <= value < 10^kk */
+	if (k >= 0 && kk <= 21) {
+		/* 1234e7 -> 12340000000 */
+		for (i = len; i < kk; i++) str[i] = '0';
+		str += kk;
+	} else if (kk > 0 && kk <= 21) {
+		/* 1234e-2 -> 12.34 */
+		memmove(&str[kk + 1], &str[kk], len - kk);
+		str[kk] = '.';
+		str += len + 1;
+	} else if (kk > -6 && kk <= 0) {
+		/* 1234e-6 -> 0.001234 */
+		int offset = 2 - kk;
+		memmove(&str[offset], &str[0], len);
+		str[0] = '0';
+		str[1] = '.';
+		for (i = 2; i < offset; i++) str[i] = '0';
+		str += len + offset;
+	} else if (len == 1) {
+		/* 1e30 */
+		str = grisu_exponent(kk - 1, str + 1);
+	} else {
+		/* 1234e30 -> 1.234e33 */
+		memmove(&str[2], &str[1], len - 1);
+		str[1] = '.';
+		str = grisu_exponent(kk - 1, str + len + 1);
+	}
+	*str = '\0';
 }
 
 static const double pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
@@ -332,13 +844,10 @@ static void modp_dtoa2(double value, char* str, int prec) {
 	double tmp;
 	uint32_t frac;
 
-    /* Hacky test for NaN
-     * under -fast-math this won't work, but then you also won't
-     * have correct nan values anyways.  The alternative is
-     * to link with libmath (bad) or hack IEEE double bits (bad)
-     */
-    if (! (value == value)) {
-        str[0] = 'n'; str[1] = 'a'; str[2] = 'n'; str[3] = '\0';
+    /* NaN, infinity and values too large for the fixed
+       conversion are written as shortest representation */
+    if (! (value > -thres_max && value < thres_max)) {
+        grisu_dtoa(value, str);
         return;
     }
 
@@ -375,17 +884,6 @@ static void modp_dtoa2(double value, char* str, int prec) {
         ++frac;
     }
 
-    /* for very large numbers switch back to native sprintf for exponentials.
-       anyone want to write code to replace this? */
-    /*
-      normal printf behavior is to print EVERY whole number digit
-      which can be 100s of characters overflowing your buffers == bad
-    */
-    if (value > thres_max) {
-        sprintf(str, "%e", neg ? -value : value);
-        return;
-    }
-
     if (prec == 0) {
         diff = value - whole;
         if (diff > 0.5) {
@@ -431,370 +929,2839 @@ static void modp_dtoa2(double value, char* str, int prec) {
     strreverse(str, wstr-1);
 }
 
-static void jwPutch(unparser_s *unparser, char c) {
-	if( (unsigned int)(unparser->bufp - unparser->buffer) >= JSON_JSON_SIZE ) {
-		unparser->error= JSON_ERROR_BUF_FULL;
-	} else {
-		*unparser->bufp++ = c;
+/**
+ * Hands the buffered output to the flush callback and empties the buffer.
+ */
+static bool jwFlush(unparser_s *unparser) {
+	size_t used = unparser->bufp - unparser->buffer;
+	if( used > 0 && unparser->flush( unparser->flushContext, unparser->buffer, used ) != 0 ) {
+		unparser->error= JSON_ERROR_FLUSH;
+		return false;
 	}
+	unparser->bufp = unparser->buffer;
+	return true;
 }
 
-static void jwPutstr(unparser_s *unparser, char *str) {
-	jwPutch( unparser, '\"' );
-	while( *str != '\0' ) jwPutch( unparser, *str++ );
-	jwPutch( unparser, '\"' );
-}
-
-static void jwPutraw(unparser_s *unparser, char *str) {
-	while( *str != '\0' ) jwPutch( unparser, *str++ );
-}
+/**
+ * Makes room for n more bytes: flushes the buffer if there is a flush
+ * callback, else enlarges it with the growth callback. Nothing more is
+ * flushed after an error, the output would have a gap.
+ */
+static bool jwMakeRoom(unparser_s *unparser, size_t n) {
+	size_t used;
+	size_t size = (unparser->size > 0) ? unparser->size * 2 : JSON_JSON_SIZE;
+	char *buffer;
 
-static void jwPretty(unparser_s *unparser) {
-	int i;
-	if( unparser->isPretty ) {
-		jwPutch( unparser, '\n' );
-		for( i=0; i < unparser->stackpos + 1; i++ )
-			jwPutraw( unparser, "    " );
+	if( unparser->error != JSON_ERROR_OK ) {
+		return false;
 	}
-}
-
-static void jwPush(unparser_s *unparser, djson_type_e nodeType) {
-	if( (unparser->stackpos + 1) >= JSON_STACK_DEPTH )
-		unparser->error = JSON_ERROR_STACK_FULL;		// array/object nesting > JSON_STACK_DEPTH
-	else {
-		unparser->nodeStack[++unparser->stackpos].nodeType= nodeType;
-		unparser->nodeStack[unparser->stackpos].elementNo= 0;
+	if( unparser->flush != NULL && unparser->bufp != unparser->buffer ) {
+		if( !jwFlush( unparser ) ) return false;
+		if( unparser->size >= n ) return true;
 	}
-}
+	used = unparser->bufp - unparser->buffer;
 
-static djson_type_e jwPop(unparser_s *unparser) {
-	djson_type_e retval= unparser->nodeStack[unparser->stackpos].nodeType;
-	if( unparser->stackpos == 0 )
-		unparser->error = JSON_ERROR_STACK_EMPTY;		// stack underflow error (too many 'end's)
-	else
-		unparser->stackpos--;
-	return retval;
+	if( unparser->growBuffer == NULL ) {
+		unparser->error= JSON_ERROR_BUF_FULL;
+		return false;
+	}
+	while( size - used < n ) size *= 2;
+	buffer = unparser->growBuffer( unparser->growContext, unparser->buffer, unparser->size, size );
+	if( buffer == NULL ) {
+		unparser->error= JSON_ERROR_BUF_FULL;
+		return false;
+	}
+	unparser->buffer = buffer;
+	unparser->bufp = buffer + used;
+	unparser->size = size;
+	return true;
 }
 
-static int _jwObj(unparser_s *unparser, char *key) {
-	if(unparser->error == JSON_ERROR_OK) {
-		unparser->callNo++;
-		if(unparser->nodeStack[unparser->stackpos].nodeType != JSON_OBJECT)
-			unparser->error = JSON_ERROR_NOT_OBJECT;			// tried to write Object key/value into Array
-		else if( unparser->nodeStack[unparser->stackpos].elementNo++ > 0 )
-			jwPutch( unparser, ',' );
-		jwPretty( unparser );
-		jwPutstr( unparser, key );
-		jwPutch( unparser, ':' );
-		if(unparser->isPretty)
-			jwPutch( unparser, ' ' );
+static void jwPutch(unparser_s *unparser, char c) {
+	if( (size_t)(unparser->bufp - unparser->buffer) >= unparser->size && !jwMakeRoom( unparser, 1 ) ) {
+		return;
 	}
-	return unparser->error;
+	*unparser->bufp++ = c;
 }
 
-static int _jwArr(unparser_s *unparser) {
-	if(unparser->error == JSON_ERROR_OK) {
-		unparser->callNo++;
-		if( unparser->nodeStack[unparser->stackpos].nodeType != JSON_ARRAY )
-			unparser->error= JSON_ERROR_NOT_ARRAY;			// tried to write array value into Object
-		else if( unparser->nodeStack[unparser->stackpos].elementNo++ > 0 )
-			jwPutch( unparser, ',' );
-		jwPretty( unparser );
+/**
+ * Writes len bytes, copying as many at once as fit into the buffer.
+ */
+static void jwPutn(unparser_s *unparser, const char *str, size_t len) {
+	while( len > 0 ) {
+		size_t room = unparser->size - (size_t)(unparser->bufp - unparser->buffer);
+		if( room == 0 ) {
+			/* A flushed buffer is filled again, a growing one gets all at once */
+			if( !jwMakeRoom( unparser, (unparser->flush != NULL) ? 1 : len ) ) return;
+			continue;
+		}
+		if( room > len ) room = len;
+		memcpy( unparser->bufp, str, room );
+		unparser->bufp += room;
+		str += room;
+		len -= room;
 	}
-	return unparser->error;
 }
 
 /**
- * Parse JSON by overgiven it and his length.
- * It returns a buffer with an array of tokens.
+ * Returns the offset of the next byte at or after pos which has to be
+ * escaped: '"', '\\', control characters and, with unicode, non-ASCII bytes.
  */
-int startParsingJSON(parser_s *parser, char *js) {
-	#ifdef JSON_THREAD_SAFE
-	if (parser->mutexInitialized == false) {
-		pthread_mutex_init (&parser->mutex, NULL);
-		parser->mutexInitialized = true;
+static size_t jwFindEscape(const char *str, size_t pos, size_t len, int unicode) {
+	#if defined(JSON_SIMD_SSE2)
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F);
+	for (; pos + 16 <= len; pos += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (str + pos));
+		__m128i match = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+				_mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(match);
+		if (unicode) mask |= (unsigned int) _mm_movemask_epi8(chunk);
+		if (mask != 0) {
+			return pos + jsmne_ctz(mask);
+		}
+	}
+	#elif defined(JSON_SIMD_NEON)
+	const uint8x16_t quote = vdupq_n_u8('\"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	const uint8x16_t control = vdupq_n_u8(0x20);
+	const uint8x16_t ascii = vdupq_n_u8(0x80);
+	for (; pos + 16 <= len; pos += 16) {
+		uint8x16_t chunk = vld1q_u8((const uint8_t *) (str + pos));
+		uint8x16_t match = vorrq_u8(
+				vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)),
+				vcltq_u8(chunk, control));
+		if (unicode) match = vorrq_u8(match, vcgeq_u8(chunk, ascii));
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+				vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+		if (mask != 0) {
+			return pos + (jsmne_ctz(mask) >> 2);
+		}
 	}
-	pthread_mutex_lock (&parser->mutex);
 	#endif
+	for (; pos < len; pos++) {
+		unsigned char c = (unsigned char) str[pos];
+		if (c == '\"' || c == '\\' || c < 0x20 || (unicode && c >= 0x80)) {
+			break;
+		}
+	}
+	return pos;
+}
 
-    jsmne_parser p;
-    jsmne_init(&p);
-
-    int len = jsmne_parse(&p, js, strlen(js), &parser->tokens[0], JSON_TOKEN_SIZE);
+static void jwPutu(unparser_s *unparser, unsigned int code) {
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = { '\\', 'u', hex[(code >> 12) & 15], hex[(code >> 8) & 15], hex[(code >> 4) & 15], hex[code & 15] };
+	jwPutn( unparser, esc, 6 );
+}
 
-    while (len == JSON_ERROR_NOMEM) {
-       return JSON_ERROR_NOMEM;
-    }
+/**
+ * Writes the escape of str[pos], returns the number of bytes it took.
+ */
+static size_t jwPutEscape(unparser_s *unparser, const char *str, size_t pos, size_t len) {
+	unsigned char c = (unsigned char) str[pos];
+	unsigned int code;
+	size_t n, i;
 
-	parser->counter = 0;
-	parser->length = len;
-	parser->json = js;
+	switch( c ) {
+		case '\"':	jwPutn( unparser, "\\\"", 2 ); return 1;
+		case '\\':	jwPutn( unparser, "\\\\", 2 ); return 1;
+		case '\b':	jwPutn( unparser, "\\b", 2 ); return 1;
+		case '\f':	jwPutn( unparser, "\\f", 2 ); return 1;
+		case '\n':	jwPutn( unparser, "\\n", 2 ); return 1;
+		case '\r':	jwPutn( unparser, "\\r", 2 ); return 1;
+		case '\t':	jwPutn( unparser, "\\t", 2 ); return 1;
+	}
+	if( c < 0x80 ) {
+		jwPutu( unparser, c );
+		return 1;
+	}
 
-    return JSON_ERROR_OK;
+	/* UTF-8 sequence, invalid ones are replaced by U+FFFD */
+	if( c >= 0xF0 && c < 0xF5 ) { n = 4; code = c & 0x07; }
+	else if( c >= 0xE0 ) { n = (c < 0xF0) ? 3 : 0; code = c & 0x0F; }
+	else if( c >= 0xC2 ) { n = 2; code = c & 0x1F; }
+	else n = 0, code = 0;
+	if( n == 0 || pos + n > len ) {
+		jwPutu( unparser, 0xFFFD );
+		return 1;
+	}
+	for( i = 1; i < n; i++ ) {
+		unsigned char d = (unsigned char) str[pos + i];
+		if( (d & 0xC0) != 0x80 ) {
+			jwPutu( unparser, 0xFFFD );
+			return 1;
+		}
+		code = (code << 6) | (d & 0x3F);
+	}
+	if( (n == 3 && (code < 0x800 || (code >= 0xD800 && code < 0xE000))) ||
+			(n == 4 && (code < 0x10000 || code > 0x10FFFF)) ) {
+		jwPutu( unparser, 0xFFFD );
+		return 1;
+	}
+	if( code >= 0x10000 ) {
+		code -= 0x10000;
+		jwPutu( unparser, 0xD800 | (code >> 10) );
+		jwPutu( unparser, 0xDC00 | (code & 0x3FF) );
+	} else {
+		jwPutu( unparser, code );
+	}
+	return n;
 }
 
-/*
- * Free tokens.
+/**
+ * Writes a quoted and escaped string. Runs without characters to escape
+ * are copied at once.
  */
-int endParsingJSON(parser_s *parser) {
-	#ifdef JSON_THREAD_SAFE
-	pthread_mutex_unlock (&parser->mutex);
-	#endif
-	return JSON_ERROR_OK;
-}
+static void jwPutstrn(unparser_s *unparser, const char *str, size_t len) {
+	size_t pos = 0;
+	size_t next = jwFindEscape( str, 0, len, unparser->escapeUnicode );
 
-token_s *getBeforeToken(parser_s *parser) {
-	if ((parser->counter > 0) && (parser->counter <= (parser->length - 1))) {
-		return &parser->tokens[parser->counter - 1];
-	} else {
-		return NULL;
+	if( next == len && unparser->size - (size_t)(unparser->bufp - unparser->buffer) >= len + 2 ) {
+		*unparser->bufp++ = '\"';
+		memcpy( unparser->bufp, str, len );
+		unparser->bufp += len;
+		*unparser->bufp++ = '\"';
+		return;
+	}
+	jwPutch( unparser, '\"' );
+	for(;;) {
+		jwPutn( unparser, str + pos, next - pos );
+		if( next >= len ) break;
+		pos = next + jwPutEscape( unparser, str, next, len );
+		next = jwFindEscape( str, pos, len, unparser->escapeUnicode );
 	}
+	jwPutch( unparser, '\"' );
 }
 
-token_s *getCurrentToken(parser_s *parser) {
-	if ((parser->counter >= 0) && (parser->counter <= (parser->length - 1))) {
-		return &parser->tokens[parser->counter];
-	} else {
-		return NULL;
-	}
+static void jwPutstr(unparser_s *unparser, const char *str) {
+	jwPutstrn( unparser, str, strlen( str ) );
 }
 
-token_s *getNextToken(parser_s *parser) {
-	if ((parser->counter >= 0) && (parser->counter < (parser->length - 1))) {
-		return &parser->tokens[parser->counter + 1];
-	} else {
-		return NULL;
-	}
+static void jwPutraw(unparser_s *unparser, const char *str) {
+	jwPutn( unparser, str, strlen( str ) );
 }
 
-bool hasBeforeToken(parser_s *parser) {
-	if (parser->counter > 0)  {
-		return true;
-	} else {
-		return false;
+static const char jwDigitPairs[200] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static size_t jwCountDigits(uint64_t value) {
+	size_t n = 1;
+	for(;;) {
+		if( value < 10 ) return n;
+		if( value < 100 ) return n + 1;
+		if( value < 1000 ) return n + 2;
+		if( value < 10000 ) return n + 3;
+		value /= 10000;
+		n += 4;
 	}
 }
 
-bool hasCurrentToken(parser_s *parser) {
-	if ((parser->counter >= 0) && (parser->counter <= (parser->length - 1))) {
-		return true;
+/**
+ * Formats an integer which ends before end, two digits at a time from the
+ * last one backwards.
+ */
+static void jwFormatu64(char *end, uint64_t value, bool negative) {
+	char *p = end;
+	while( value >= 100 ) {
+		const char *pair = &jwDigitPairs[(value % 100) * 2];
+		value /= 100;
+		*--p = pair[1];
+		*--p = pair[0];
+	}
+	if( value >= 10 ) {
+		*--p = jwDigitPairs[value * 2 + 1];
+		*--p = jwDigitPairs[value * 2];
 	} else {
-		return false;
+		*--p = (char)('0' + value);
 	}
+	if( negative ) *--p = '-';
 }
 
-bool hasNextToken(parser_s *parser) {
-	if (parser->counter < (parser->length - 1))  {
-		return true;
-	} else {
-		return false;
+/**
+ * Writes an integer straight into the buffer. Without room for all digits
+ * it is formatted aside, so that a fixed or flushed buffer takes as many
+ * bytes as fit, like with any other output.
+ */
+static void jwPutu64(unparser_s *unparser, uint64_t value, bool negative) {
+	size_t n = jwCountDigits( value ) + negative;
+
+	if( unparser->size - (size_t)(unparser->bufp - unparser->buffer) < n ) {
+		jwFormatu64( unparser->tmpbuf + n, value, negative );
+		jwPutn( unparser, unparser->tmpbuf, n );
+		return;
 	}
+	jwFormatu64( unparser->bufp + n, value, negative );
+	unparser->bufp += n;
 }
 
-void beforeToken(parser_s *parser) {
-	parser->counter = parser->counter - 1;
+static void jwPuti64(unparser_s *unparser, int64_t value) {
+	/* negate in unsigned arithmetic, INT64_MIN has no positive counterpart */
+	jwPutu64( unparser, (value < 0) ? 0 - (uint64_t)value : (uint64_t)value, value < 0 );
 }
 
-void nextToken(parser_s *parser) {
-	parser->counter = parser->counter + 1;
+static void jwPretty(unparser_s *unparser) {
+	int i;
+	if( unparser->isPretty ) {
+		jwPutch( unparser, '\n' );
+		for( i=0; i < unparser->stackpos + 1; i++ )
+			jwPutn( unparser, "    ", 4 );
+	}
 }
 
-size_t sizeOfTokens(parser_s *parser) {
-	return parser->length;
+static void jwPush(unparser_s *unparser, djson_type_e nodeType) {
+	if( (unparser->stackpos + 1) >= JSON_STACK_DEPTH )
+		unparser->error = JSON_ERROR_STACK_FULL;		// array/object nesting > JSON_STACK_DEPTH
+	else {
+		unparser->nodeStack[++unparser->stackpos].nodeType= nodeType;
+		unparser->nodeStack[unparser->stackpos].elementNo= 0;
+	}
 }
 
-/*
- * Check if token is equal to a string.
- */
-bool tokenEqualString(parser_s *parser, char *s) {
-    return (strncmp(parser->json + parser->tokens[parser->counter].start, s, parser->tokens[parser->counter].end - parser->tokens[parser->counter].start) == 0
-            && strlen(s) == (size_t) (parser->tokens[parser->counter].end - parser->tokens[parser->counter].start));
+static djson_type_e jwPop(unparser_s *unparser) {
+	djson_type_e retval= unparser->nodeStack[unparser->stackpos].nodeType;
+	if( unparser->stackpos == 0 )
+		unparser->error = JSON_ERROR_STACK_EMPTY;		// stack underflow error (too many 'end's)
+	else
+		unparser->stackpos--;
+	return retval;
 }
 
-/*
- * Return the string of the token.
- */
-char* tokenToString(parser_s *parser) {
-    parser->json[parser->tokens[parser->counter].end] = '\0';
-    return parser->json + parser->tokens[parser->counter].start;
+static int _jwObjN(unparser_s *unparser, const char *key, size_t keylen) {
+	if(unparser->error == JSON_ERROR_OK) {
+		unparser->callNo++;
+		if(unparser->nodeStack[unparser->stackpos].nodeType != JSON_OBJECT)
+			unparser->error = JSON_ERROR_NOT_OBJECT;			// tried to write Object key/value into Array
+		else if( unparser->nodeStack[unparser->stackpos].elementNo++ > 0 )
+			jwPutch( unparser, ',' );
+		jwPretty( unparser );
+		jwPutstrn( unparser, key, keylen );
+		jwPutch( unparser, ':' );
+		if(unparser->isPretty)
+			jwPutch( unparser, ' ' );
+	}
+	return unparser->error;
 }
 
-int beforeTokenType(parser_s *parser) {
-	if (parser->counter > 0)  {
-		return parser->tokens[parser->counter - 1].type;
-	} else {
-		return -1;
-	}
+static int _jwObj(unparser_s *unparser, const char *key) {
+	return _jwObjN( unparser, key, strlen( key ) );
 }
 
-int currentTokenType(parser_s *parser) {
-	if ((parser->counter >= 0) && (parser->counter <= (parser->length - 1))) {
-		return parser->tokens[parser->counter].type;
-	} else {
-		return -1;
+static int _jwArr(unparser_s *unparser) {
+	if(unparser->error == JSON_ERROR_OK) {
+		unparser->callNo++;
+		if( unparser->nodeStack[unparser->stackpos].nodeType != JSON_ARRAY )
+			unparser->error= JSON_ERROR_NOT_ARRAY;			// tried to write array value into Object
+		else if( unparser->nodeStack[unparser->stackpos].elementNo++ > 0 )
+			jwPutch( unparser, ',' );
+		jwPretty( unparser );
 	}
+	return unparser->error;
 }
 
-int nextTokenType(parser_s *parser) {
-	if (parser->counter < (parser->length - 1))  {
-		return parser->tokens[parser->counter + 1].type;
-	} else {
-		return -1;
+/**
+ * Default allocator for token and output buffers, based on realloc() and free().
+ * Only usable for buffers which are NULL or were allocated with malloc().
+ */
+void *reallocJSON(void *ctx, void *ptr, size_t oldSize, size_t newSize) {
+	(void) ctx;
+	(void) oldSize;
+	if (newSize == 0) {
+		free(ptr);
+		return NULL;
 	}
+	return realloc(ptr, newSize);
 }
 
-int startUnparsingJSON(unparser_s *unparser, djson_type_e rootType, djson_format_e isPretty) {
+/**
+ * Prepares a parser to use the given tokens. If growTokens is set, the buffer
+ * is enlarged with it when a JSON has more tokens. tokens may be NULL then.
+ */
+void initParsingJSON(parser_s *parser, token_s *tokens, size_t numTokens,
+		djson_realloc_f growTokens, void *growContext) {
+	parser->json = NULL;
+	parser->counter = 0;
+	parser->length = 0;
+	parser->tokens = tokens;
+	parser->numTokens = (tokens != NULL) ? numTokens : 0;
+	parser->growTokens = growTokens;
+	parser->growContext = growContext;
+	parser->jsonLength = 0;
+	parser->lazy = false;
+	parser->skipped = false;
+	parser->frozen = false;
+	parser->error = JSON_ERROR_OK;
+	parser->keyIndex = NULL;
+	parser->keyIndexSize = 0;
+	parser->keyIndexUsed = 0;
+	parser->isParsing = false;
+	jsmne_init(&parser->state);
 	#ifdef JSON_THREAD_SAFE
-	if (unparser->mutexInitialized == false) {
-		pthread_mutex_init (&unparser->mutex, NULL);
-		unparser->mutexInitialized = true;
-	}
-	pthread_mutex_lock (&unparser->mutex);
+	pthread_mutex_init (&parser->mutex, NULL);
+	parser->mutexInitialized = true;
 	#endif
-
-	unparser->bufp= &unparser->buffer[0];
-	unparser->nodeStack[0].nodeType= rootType;
-	unparser->nodeStack[0].elementNo= 0;
-	unparser->stackpos = 0;
-	unparser->error = JSON_ERROR_OK;
-	unparser->callNo = 1;
-	unparser->isPretty= isPretty;
-	jwPutch( unparser, (rootType==JSON_STRING) ? '{' : '[' );
-	return JSON_ERROR_OK;
 }
 
-int endUnparsingJSON(unparser_s *unparser) {
+/**
+ * Releases the token buffer with the growth callback, if there is one.
+ */
+void freeParsingJSON(parser_s *parser) {
+	if (parser->growTokens != NULL && parser->tokens != NULL) {
+		parser->growTokens(parser->growContext, parser->tokens,
+				parser->numTokens * sizeof(token_s), 0);
+	}
+	if (parser->growTokens != NULL && parser->keyIndex != NULL) {
+		parser->growTokens(parser->growContext, parser->keyIndex,
+				parser->keyIndexSize * sizeof(struct struct_keyentry_s), 0);
+	}
+	parser->tokens = NULL;
+	parser->numTokens = 0;
+	parser->keyIndex = NULL;
+	parser->keyIndexSize = 0;
+	parser->keyIndexUsed = 0;
+	parser->length = 0;
 	#ifdef JSON_THREAD_SAFE
-	pthread_mutex_unlock (&unparser->mutex);
+	if (parser->mutexInitialized == true) {
+		pthread_mutex_destroy (&parser->mutex);
+		parser->mutexInitialized = false;
+	}
 	#endif
-	return JSON_ERROR_OK;
-}
-
-char *getJSON(unparser_s *unparser) {
-	return &unparser->buffer[0];
 }
 
-size_t getJSONSize(unparser_s *unparser) {
-	return strlen(&unparser->buffer[0]);
-}
+/**
+ * Locks the parser and resets it for a new JSON.
+ */
+static void jsmne_begin(parser_s *parser) {
+	#ifdef JSON_THREAD_SAFE
+	pthread_mutex_lock (&parser->mutex);
+	#endif
 
-int endJSON(unparser_s *unparser) {
-	if( unparser->error == JSON_ERROR_OK ) {
-		if( unparser->stackpos == 0 ) {
-			djson_type_e node= unparser->nodeStack[0].nodeType;
-			if(unparser->isPretty) jwPutch( unparser, '\n' );
-			jwPutch( unparser, (node == JSON_OBJECT) ? '}' : ']');
-		} else {
-			unparser->error = JSON_ERROR_NEST_ERROR;	// nesting error, not all objects closed when unparserlose() called
-		}
+	jsmne_init(&parser->state);
+	parser->counter = 0;
+	parser->length = 0;
+	parser->isParsing = true;
+	parser->lazy = false;
+	parser->skipped = false;
+	parser->frozen = false;
+	parser->error = JSON_ERROR_OK;
+	/* The key index belongs to the last JSON */
+	if (parser->keyIndexUsed > 0) {
+		memset(parser->keyIndex, 0, parser->keyIndexSize * sizeof(struct struct_keyentry_s));
+		parser->keyIndexUsed = 0;
 	}
-	return unparser->error;
 }
 
-int endObject(unparser_s *unparser) {
-	if( unparser->error == JSON_ERROR_OK ) {
-		djson_type_e node;
-		int lastElemNo= unparser->nodeStack[unparser->stackpos].elementNo;
-		node= jwPop( unparser );
-		if( lastElemNo > 0 ) jwPretty( unparser );
-		jwPutch( unparser, (node == JSON_OBJECT) ? '}' : ']');
+/**
+ * Tokenizes js up to len, continuing at the position where the last call stopped.
+ */
+static int jsmne_continue(parser_s *parser, const char *js, size_t len) {
+	json_offset_t r;
+
+	parser->json = js;
+	parser->jsonLength = len;
+	if (len >= (size_t) JSON_OFFSET_MAX) {
+		parser->error = JSON_ERROR_TOO_LARGE;
+		return parser->error;
 	}
-	return unparser->error;
-}
 
-int endArray(unparser_s *unparser) {
-	if( unparser->error == JSON_ERROR_OK ) {
-		djson_type_e node;
-		int lastElemNo= unparser->nodeStack[unparser->stackpos].elementNo;
-		node= jwPop( unparser );
-		if( lastElemNo > 0 ) jwPretty( unparser );
-		jwPutch( unparser, (node == JSON_OBJECT) ? '}' : ']');
+	/* Not enough tokens: enlarge the buffer and resume where the parser stopped */
+	if (parser->tokens == NULL && !jsmne_grow_tokens(parser)) {
+		return JSON_ERROR_NOMEM;
 	}
-	return unparser->error;
+	r = jsmne_parse(&parser->state, js, len, parser->tokens, parser->numTokens);
+	while (r == JSON_ERROR_NOMEM && jsmne_grow_tokens(parser)) {
+		r = jsmne_parse(&parser->state, js, len, parser->tokens, parser->numTokens);
+	}
+	parser->length = parser->state.toknext;
+	parser->error = (r < 0) ? (int) r : JSON_ERROR_OK;
+	return parser->error;
 }
 
-int getError(unparser_s *unparser) {
-	return unparser->callNo;
+/**
+ * Parse JSON by overgiven it and his length.
+ * It returns a buffer with an array of tokens.
+ */
+int startParsingJSON(parser_s *parser, char *js) {
+	jsmne_begin(parser);
+	return jsmne_continue(parser, js, strlen(js));
 }
 
-void addRawTextToObject(unparser_s *unparser, char *key, char *rawtext) {
-	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutraw( unparser, rawtext);
+/**
+ * Parses the first len bytes of js, which needs no terminating '\0' and is
+ * never written to, e.g. a memory mapped file or a slice of a receive buffer.
+ * tokenToString() must not be used on such a JSON.
+ */
+int startParsingJSONn(parser_s *parser, const char *js, size_t len) {
+	jsmne_begin(parser);
+	return jsmne_continue(parser, js, len);
 }
 
-void addStringToObject(unparser_s *unparser, char *key, char *value) {
-	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutstr( unparser, value );
-}
+/**
+ * Parses a JSON which arrives in chunks. js holds all bytes received so far
+ * up to len; it may be moved between calls, but the bytes passed before must
+ * stay unchanged. Every byte is scanned once, apart from an unfinished string
+ * or primitive at the end of a chunk. Returns JSON_ERROR_PART until the JSON
+ * is complete; the tokens finished so far can be read already. A number,
+ * true, false or null as root is complete once a byte follows it, e.g. a
+ * newline.
+ */
+int feedParsingJSON(parser_s *parser, const char *js, size_t len) {
+	int r;
 
-void addIntegerToObject(unparser_s *unparser, char *key, int value) {
-	modp_itoa10( value, unparser->tmpbuf );
-	addRawTextToObject( unparser, key, unparser->tmpbuf );
+	if (parser->isParsing == false) {
+		jsmne_begin(parser);
+		parser->state.feed = true;
+	}
+	r = jsmne_continue(parser, js, len);
+	if (r == JSON_ERROR_OK && parser->length == 0) {
+		return JSON_ERROR_PART;
+	}
+	return r;
 }
 
-void addDoubleToObject(unparser_s *unparser, char *key, double value) {
-	modp_dtoa2( value, unparser->tmpbuf, 6 );
-	addRawTextToObject( unparser, key, unparser->tmpbuf );
-}
+/**
+ * Lazy parsing: tokenizes until index is a valid token or the JSON ends.
+ * A stop of 0 tokenizes everything.
+ */
+static void jsmne_advance(parser_s *parser, size_t stop) {
+	int r;
 
-void addBooleanToObject(unparser_s *unparser, char *key, int oneOrZero) {
-	addRawTextToObject( unparser, key, (oneOrZero) ? "true" : "false" );
+	if (parser->lazy == false) {
+		return;
+	}
+	parser->state.tokstop = stop;
+	r = jsmne_continue(parser, parser->json, parser->jsonLength);
+	parser->state.tokstop = 0;
+	if (r < 0 || parser->state.pos >= parser->jsonLength) {
+		parser->lazy = false;
+	}
 }
 
-void addNullToObject(unparser_s *unparser, char *key) {
-	addRawTextToObject( unparser, key, "null" );
+/**
+ * Returns true if the token at index exists, tokenizing up to it in lazy mode.
+ */
+static bool jsmne_need(parser_s *parser, size_t index) {
+	if (index >= parser->length && parser->lazy) {
+		jsmne_advance(parser, index + 1);
+	}
+	return index < parser->length;
 }
 
-void addObjectToObject(unparser_s *unparser, char *key) {
-	if(_jwObj( unparser, key ) == JSON_ERROR_OK) {
-		jwPutch( unparser, '{' );
-		jwPush( unparser, JSON_OBJECT );
+/**
+ * Lazy parsing: finds the bracket closing an object or array whose contents
+ * start at pos, looking at brackets and strings only. Returns len if there
+ * is none.
+ */
+static size_t jsmne_match(const char *js, size_t pos, size_t len) {
+	int depth = 1;
+
+	for (; pos < len; pos++) {
+		char c = js[pos];
+		if (c == '\"') {
+			pos = jsmne_find_string_end(js, pos + 1, len);
+			while (pos < len && js[pos] == '\\') {
+				pos = jsmne_find_string_end(js, pos + 2, len);
+			}
+			if (pos >= len) {
+				break;
+			}
+		} else if (c == '{' || c == '[') {
+			depth++;
+		} else if ((c == '}' || c == ']') && --depth == 0) {
+			return pos;
+		}
 	}
+	return len;
 }
 
-void addArrayToObject(unparser_s *unparser, char *key) {
-	if(_jwObj( unparser, key ) == JSON_ERROR_OK) {
-		jwPutch( unparser, '[' );
-		jwPush( unparser, JSON_ARRAY );
+/**
+ * Lazy parsing: jumps over the contents of the innermost open object or
+ * array, which has no tokens yet, by matching brackets only. The contents
+ * are not validated and get no tokens, its size is set to -1.
+ */
+static int jsmne_skip_container(parser_s *parser) {
+	jsmne_parser *state = &parser->state;
+	token_s *token = &parser->tokens[state->stack[state->depth - 1]];
+	size_t pos = jsmne_match(parser->json, state->pos, parser->jsonLength);
+
+	if (pos >= parser->jsonLength) {
+		return JSON_ERROR_PART;
 	}
+	if (TOKEN_TYPE(token) != (parser->json[pos] == '}' ? JSON_OBJECT : JSON_ARRAY)) {
+		return JSON_ERROR_INVAL;
+	}
+	token->end = (json_offset_t) pos + 1;
+	TOKEN_CLOSE(token, (json_offset_t) state->toknext);
+	TOKEN_SET_SKIPPED(token);
+	parser->skipped = true;
+	state->depth--;
+	state->toksuper = (state->depth > 0) ? state->stack[state->depth - 1] : -1;
+	state->pos = pos + 1;
+	return JSON_ERROR_OK;
 }
 
-void addRawTextToArray(unparser_s *unparser, char *rawtext) {
-	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutraw( unparser, rawtext);
+/**
+ * Lazy parsing: makes sure the token at index has its end, an object or
+ * array may still be open. Its end is found by bracket matching, so its
+ * contents can still be tokenized later on.
+ */
+static token_s *jsmne_token(parser_s *parser, size_t index) {
+	token_s *token = &parser->tokens[index];
+	if (token->end < 0 && parser->lazy) {
+		size_t pos = jsmne_match(parser->json, token->start + 1, parser->jsonLength);
+		if (pos < parser->jsonLength) {
+			token->end = (json_offset_t) pos + 1;
+		}
+	}
+	return token;
+}
+
+/**
+ * Lazy parsing: closes the object or array at index with as few tokens as
+ * possible. Contents without tokens yet are skipped by bracket matching.
+ */
+static void jsmne_finish(parser_s *parser, size_t index) {
+	while (TOKEN_SKIP(&parser->tokens[index]) < 0 && parser->lazy) {
+		jsmne_parser *state = &parser->state;
+		if (state->depth > 0 && state->toknext == (size_t) state->stack[state->depth - 1] + 1) {
+			int r = jsmne_skip_container(parser);
+			if (r < 0) {
+				parser->error = r;
+				parser->lazy = false;
+			}
+		} else {
+			jsmne_advance(parser, state->toknext + 1);
+		}
+	}
+}
+
+/**
+ * Lazy parsing: children of the object or array at container up to the one
+ * holding index, stepping over the closed ones.
+ */
+static json_offset_t jsmne_children(parser_s *parser, size_t container, size_t index) {
+	json_offset_t n = 0;
+	size_t i = container + 1;
+
+	while (i <= index) {
+		token_s *token = &parser->tokens[i];
+		n++;
+		if (TOKEN_TYPE(token) == JSON_STRING && TOKEN_SIZE(token) > 0) {
+			token = &parser->tokens[++i];
+		}
+		if (TOKEN_TYPE(token) == JSON_OBJECT || TOKEN_TYPE(token) == JSON_ARRAY) {
+			if (TOKEN_SKIP(token) < 0 || (size_t) TOKEN_SKIP(token) > index) {
+				break;
+			}
+			i = TOKEN_SKIP(token);
+		} else {
+			i++;
+		}
+	}
+	return n;
+}
+
+/**
+ * Lazy parsing: tokenizes an object or array whose contents were skipped.
+ * The tokens behind it are dropped and the tokenizer restarts behind its
+ * opening bracket, with it and the objects and arrays around it open again,
+ * so its tokens are those of an eager parse. The tokens behind it get new
+ * indexes.
+ */
+static void jsmne_enter(parser_s *parser, size_t index) {
+	jsmne_parser *state = &parser->state;
+	json_offset_t path[JSON_PARSE_DEPTH];
+	json_offset_t i;
+	int depth = 0;
+
+	if (index >= parser->length || !TOKEN_SKIPPED(&parser->tokens[index])) {
+		return;
+	}
+	/* The objects and arrays from index up to the root */
+	for (i = (json_offset_t) index; i >= 0 && depth < JSON_PARSE_DEPTH; i = TOKEN_PARENT(&parser->tokens[i])) {
+		if (TOKEN_TYPE(&parser->tokens[i]) == JSON_OBJECT || TOKEN_TYPE(&parser->tokens[i]) == JSON_ARRAY) {
+			path[depth++] = i;
+		}
+	}
+	/* Reopened from the root down, the children counted up to index */
+	state->depth = 0;
+	while (depth > 0) {
+		token_s *token = &parser->tokens[path[--depth]];
+		TOKEN_REOPEN(token, jsmne_children(parser, path[depth], index));
+		token->end = -1;
+		state->stack[state->depth++] = path[depth];
+	}
+	state->pos = parser->tokens[index].start + 1;
+	state->toknext = index + 1;
+	state->toksuper = (json_offset_t) index;
+	parser->length = index + 1;
+	parser->lazy = true;
+	parser->error = JSON_ERROR_OK;
+	/* The key index may hold dropped tokens */
+	if (parser->keyIndexUsed > 0) {
+		memset(parser->keyIndex, 0, parser->keyIndexSize * sizeof(struct struct_keyentry_s));
+		parser->keyIndexUsed = 0;
+	}
+	while (TOKEN_SKIP(&parser->tokens[index]) < 0 && parser->lazy) {
+		jsmne_advance(parser, state->toknext + 1);
+	}
+}
+
+/**
+ * Lazy parsing: tokenizes the rest of the JSON and every object or array
+ * skipped so far.
+ */
+static void jsmne_expand(parser_s *parser) {
+	size_t i;
+
+	jsmne_advance(parser, 0);
+	for (i = 0; parser->skipped && i < parser->length; i++) {
+		if (TOKEN_SKIPPED(&parser->tokens[i])) {
+			/* Drops the tokens behind it, so one is enough */
+			jsmne_enter(parser, i);
+			jsmne_advance(parser, 0);
+			break;
+		}
+	}
+	parser->skipped = false;
+}
+
+/**
+ * Starts an on-demand parse: the cursor functions, skipToken(), findKey()
+ * and evalPath() tokenize the JSON only as far as they need it, objects and
+ * arrays skipped over are only bracket matched. Errors behind the first token
+ * are reported by getParsingError() once they are reached.
+ *
+ * A skipped object or array gets its tokens once a lookup, tokenAtSize() or
+ * the cursor goes into it, the tokens are then those of an eager parse. The
+ * tokens behind it are created anew, so indexes of tokens behind it which
+ * were found before are no longer valid.
+ */
+int startParsingJSONLazy(parser_s *parser, const char *js, size_t len) {
+	jsmne_begin(parser);
+	parser->json = js;
+	parser->jsonLength = len;
+	if (parser->tokens == NULL && !jsmne_grow_tokens(parser)) {
+		return JSON_ERROR_NOMEM;
+	}
+	parser->lazy = true;
+	jsmne_advance(parser, 1);
+	return parser->error;
+}
+
+/**
+ * Returns the error of the parse so far, e.g. of a lazy parse.
+ */
+int getParsingError(parser_s *parser) {
+	return parser->error;
+}
+
+/*
+ * Unlocks the parser, the tokens stay valid until the next parse.
+ */
+int endParsingJSON(parser_s *parser) {
+	parser->isParsing = false;
+	#ifdef JSON_THREAD_SAFE
+	pthread_mutex_unlock (&parser->mutex);
+	#endif
+	return JSON_ERROR_OK;
+}
+
+token_s *getBeforeToken(parser_s *parser) {
+	if ((parser->counter > 0) && jsmne_need(parser, parser->counter)) {
+		return &parser->tokens[parser->counter - 1];
+	} else {
+		return NULL;
+	}
+}
+
+token_s *getCurrentToken(parser_s *parser) {
+	if (jsmne_need(parser, parser->counter)) {
+		return &parser->tokens[parser->counter];
+	} else {
+		return NULL;
+	}
+}
+
+token_s *getNextToken(parser_s *parser) {
+	if (jsmne_need(parser, parser->counter + 1)) {
+		return &parser->tokens[parser->counter + 1];
+	} else {
+		return NULL;
+	}
+}
+
+bool hasBeforeToken(parser_s *parser) {
+	if (parser->counter > 0)  {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+bool hasCurrentToken(parser_s *parser) {
+	if (jsmne_need(parser, parser->counter)) {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+bool hasNextToken(parser_s *parser) {
+	if (jsmne_need(parser, parser->counter + 1))  {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+void beforeToken(parser_s *parser) {
+	parser->counter = parser->counter - 1;
+}
+
+void nextToken(parser_s *parser) {
+	/* Into an object or array a lazy parse skipped */
+	jsmne_enter(parser, parser->counter);
+	parser->counter = parser->counter + 1;
+}
+
+/*
+ * Index of the first token after the token at index and all tokens inside
+ * of it. For a key this is behind its value.
+ */
+static size_t jsmne_skip(parser_s *parser, size_t index) {
+	token_s *token;
+	/* The value of a key may not have a token yet */
+	if (parser->lazy && TOKEN_TYPE(&parser->tokens[index]) == JSON_STRING && TOKEN_SIZE(&parser->tokens[index]) == 0) {
+		jsmne_need(parser, index + 1);
+	}
+	token = &parser->tokens[index];
+	if (TOKEN_TYPE(token) == JSON_STRING && TOKEN_SIZE(token) > 0 && index + 1 < parser->length) {
+		token = &parser->tokens[++index];
+	}
+	if (TOKEN_TYPE(token) == JSON_OBJECT || TOKEN_TYPE(token) == JSON_ARRAY) {
+		if (TOKEN_SKIP(token) < 0 && parser->lazy) {
+			jsmne_finish(parser, index);
+			token = &parser->tokens[index];
+		}
+		/* Not closed yet */
+		return (TOKEN_SKIP(token) >= 0) ? (size_t) TOKEN_SKIP(token) : parser->length;
+	}
+	return index + 1;
+}
+
+/*
+ * Number of keys or elements of an object or array, tokenizing it if a lazy
+ * parse skipped its contents. Compact tokens of closed ones are counted, up
+ * to limit only.
+ */
+static json_offset_t jsmne_size(parser_s *parser, size_t index, json_offset_t limit) {
+	token_s *token;
+	#ifdef JSON_COMPACT_TOKENS
+	size_t i;
+	json_offset_t n = 0;
+	#endif
+
+	jsmne_finish(parser, index);
+	jsmne_enter(parser, index);
+	token = &parser->tokens[index];
+	#ifdef JSON_COMPACT_TOKENS
+	if (TOKEN_SKIP(token) < 0) {
+		return TOKEN_SIZE(token);
+	}
+	for (i = index + 1; i < (size_t) TOKEN_SKIP(token) && n < limit; i = jsmne_skip(parser, i)) {
+		n++;
+	}
+	return n;
+	#else
+	(void) limit;
+	return token->size;
+	#endif
+}
+
+/*
+ * FNV-1a hash of a key as it is written in the JSON.
+ */
+static uint32_t jsmne_hash(const char *key, size_t length) {
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char) key[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * First slot of a key in the index.
+ */
+static size_t jsmne_slot(parser_s *parser, json_offset_t object, uint32_t hash) {
+	uint32_t h = hash ^ ((uint32_t) object * 0x9E3779B1u);
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	return h & (parser->keyIndexSize - 1);
+}
+
+/*
+ * Adds an entry to the index, which must have a free entry.
+ */
+static void jsmne_index_insert(parser_s *parser, json_offset_t object, json_offset_t key, uint32_t hash) {
+	size_t i = jsmne_slot(parser, object, hash);
+	while (parser->keyIndex[i].key != 0) {
+		i = (i + 1) & (parser->keyIndexSize - 1);
+	}
+	parser->keyIndex[i].object = object;
+	parser->keyIndex[i].key = key;
+	parser->keyIndex[i].hash = hash;
+	parser->keyIndexUsed++;
+}
+
+/*
+ * Makes room for count more entries, keeping the index at most half full.
+ */
+static bool jsmne_index_reserve(parser_s *parser, size_t count) {
+	struct struct_keyentry_s *old = parser->keyIndex;
+	size_t oldSize = parser->keyIndexSize;
+	size_t size = (oldSize > 0) ? oldSize : 64;
+	size_t i;
+
+	while ((parser->keyIndexUsed + count) * 2 > size) {
+		size *= 2;
+	}
+	if (size == oldSize) {
+		return true;
+	}
+	parser->keyIndex = parser->growTokens(parser->growContext, NULL, 0,
+			size * sizeof(struct struct_keyentry_s));
+	if (parser->keyIndex == NULL) {
+		parser->keyIndex = old;
+		return false;
+	}
+	memset(parser->keyIndex, 0, size * sizeof(struct struct_keyentry_s));
+	parser->keyIndexSize = size;
+	parser->keyIndexUsed = 0;
+	for (i = 0; i < oldSize; i++) {
+		if (old[i].key != 0) {
+			jsmne_index_insert(parser, old[i].object, old[i].key, old[i].hash);
+		}
+	}
+	if (old != NULL) {
+		parser->growTokens(parser->growContext, old, oldSize * sizeof(struct struct_keyentry_s), 0);
+	}
+	return true;
+}
+
+/*
+ * Adds all keys of a closed object to the index.
+ */
+static bool jsmne_index_object(parser_s *parser, size_t object) {
+	size_t i = object + 1;
+	json_offset_t n, size = jsmne_size(parser, object, JSON_OFFSET_MAX);
+
+	if (parser->growTokens == NULL || parser->frozen || !jsmne_index_reserve(parser, size + 1)) {
+		return false;
+	}
+	for (n = 0; n < size; n++) {
+		token_s *key = &parser->tokens[i];
+		jsmne_index_insert(parser, (json_offset_t) object, (json_offset_t) i + 1,
+				jsmne_hash(parser->json + key->start, key->end - key->start));
+		i = jsmne_skip(parser, i);
+	}
+	jsmne_index_insert(parser, (json_offset_t) object, -1, 0);
+	return true;
+}
+
+/*
+ * Looks up an object in the index: returns the entry of the key, or of the
+ * object itself if key is NULL, or NULL.
+ */
+static struct struct_keyentry_s *jsmne_index_find(parser_s *parser, size_t object,
+		const char *key, size_t length, uint32_t hash) {
+	size_t i;
+	if (parser->keyIndexUsed == 0) {
+		return NULL;
+	}
+	i = jsmne_slot(parser, (json_offset_t) object, hash);
+	for (; parser->keyIndex[i].key != 0; i = (i + 1) & (parser->keyIndexSize - 1)) {
+		struct struct_keyentry_s *entry = &parser->keyIndex[i];
+		if (entry->object != (json_offset_t) object || entry->hash != hash) {
+			continue;
+		}
+		if (key == NULL) {
+			if (entry->key == -1) return entry;
+		} else if (entry->key > 0) {
+			token_s *token = &parser->tokens[entry->key - 1];
+			if ((size_t) (token->end - token->start) == length &&
+					memcmp(parser->json + token->start, key, length) == 0) {
+				return entry;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * findKeyN() with the hash of the key computed already.
+ */
+static json_offset_t jsmne_find_key(parser_s *parser, size_t object, const char *key,
+		size_t length, uint32_t hash) {
+	size_t i, n;
+
+	if (!jsmne_need(parser, object) || TOKEN_TYPE(&parser->tokens[object]) != JSON_OBJECT) {
+		return -1;
+	}
+	jsmne_enter(parser, object);
+	if (TOKEN_SKIP(&parser->tokens[object]) >= 0 && (jsmne_index_find(parser, object, NULL, 0, 0) != NULL ||
+			jsmne_size(parser, object, JSON_KEY_INDEX_MIN) >= JSON_KEY_INDEX_MIN)) {
+		struct struct_keyentry_s *entry;
+		if (jsmne_index_find(parser, object, NULL, 0, 0) != NULL ||
+				jsmne_index_object(parser, object)) {
+			entry = jsmne_index_find(parser, object, key, length, hash);
+			if (entry == NULL || TOKEN_SIZE(&parser->tokens[entry->key - 1]) == 0) {
+				return -1;
+			}
+			return entry->key;
+		}
+	}
+	/* Keys are the tokens with the object as parent */
+	for (i = object + 1, n = 0; jsmne_need(parser, i) && TOKEN_PARENT(&parser->tokens[i]) == (json_offset_t) object;
+			i = jsmne_skip(parser, i), n++) {
+		token_s *token = &parser->tokens[i];
+		/* The key at i makes the object large, a lazy parse tokenizes it to its end for the index */
+		if (n == JSON_KEY_INDEX_MIN - 1) {
+			jsmne_finish(parser, object);
+			if (TOKEN_SKIP(&parser->tokens[object]) >= 0 && jsmne_index_object(parser, object)) {
+				return jsmne_find_key(parser, object, key, length, hash);
+			}
+			token = &parser->tokens[i];
+		}
+		if ((size_t) (token->end - token->start) == length &&
+				memcmp(parser->json + token->start, key, length) == 0) {
+			jsmne_need(parser, i + 1);
+			return (TOKEN_SIZE(&parser->tokens[i]) > 0) ? (json_offset_t) i + 1 : -1;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Finds a key of an object, returns the index of its value or -1. Small
+ * objects are scanned, larger ones get a hash index on the first lookup,
+ * in a lazy parse the object is tokenized to its end for it.
+ * The key is compared with the JSON as it is, escapes are not decoded.
+ */
+json_offset_t findKeyN(parser_s *parser, size_t object, const char *key, size_t length) {
+	return jsmne_find_key(parser, object, key, length, jsmne_hash(key, length));
+}
+
+json_offset_t findKey(parser_s *parser, size_t object, const char *key) {
+	return findKeyN(parser, object, key, strlen(key));
+}
+
+/**
+ * Finishes the parse for sharing it between threads: tokenizes the rest of
+ * a lazy parse, builds the key index of every large object and ends the
+ * parse. Afterwards the functions taking a token index - findKey(),
+ * findKeyN(), evalPath(), tokenAtToView() - only read the parser and may be
+ * called concurrently, until the parser is started again. Returns
+ * JSON_ERROR_NOMEM if the index could not be allocated; the parse may still
+ * be shared, findKey() then searches the keys one by one.
+ */
+int freezeParsingJSON(parser_s *parser) {
+	size_t i, keys = 0;
+	bool indexed = true;
+
+	jsmne_expand(parser);
+	/* Nothing is tokenized on demand any more */
+	assert(!parser->lazy && !parser->skipped);
+	for (i = 0; i < parser->length; i++) {
+		json_offset_t size;
+		if (TOKEN_TYPE(&parser->tokens[i]) == JSON_OBJECT &&
+				(size = jsmne_size(parser, i, JSON_OFFSET_MAX)) >= JSON_KEY_INDEX_MIN) {
+			keys += size + 1;
+		}
+	}
+	if (keys > 0 && parser->growTokens != NULL) {
+		indexed = jsmne_index_reserve(parser, keys);
+		for (i = 0; indexed && i < parser->length; i++) {
+			if (TOKEN_TYPE(&parser->tokens[i]) == JSON_OBJECT &&
+					jsmne_size(parser, i, JSON_KEY_INDEX_MIN) >= JSON_KEY_INDEX_MIN &&
+					jsmne_index_find(parser, i, NULL, 0, 0) == NULL) {
+				indexed = jsmne_index_object(parser, i);
+			}
+		}
+	}
+	/* Concurrent lookups must not build indexes */
+	parser->frozen = true;
+	endParsingJSON(parser);
+	if (parser->error == JSON_ERROR_OK && !indexed) {
+		return JSON_ERROR_NOMEM;
+	}
+	return parser->error;
+}
+
+/*
+ * Compiles a JSON Pointer like "/orders/3/price" or a dotted path like
+ * "orders.3.price" for evalPath(). An empty expression selects the root.
+ */
+int compilePath(path_s *path, const char *expression) {
+	bool pointer = (expression[0] == '/');
+	const char *c = pointer ? expression + 1 : expression;
+	size_t used = 0;
+
+	path->count = 0;
+	if (*expression == '\0') {
+		return JSON_ERROR_OK;
+	}
+	for (;;) {
+		pathsegment_t *segment;
+		size_t i;
+
+		if (path->count >= JSON_PATH_DEPTH) {
+			return JSON_ERROR_NOMEM;
+		}
+		segment = &path->segments[path->count++];
+		segment->offset = used;
+		for (; *c != '\0' && *c != (pointer ? '/' : '.'); c++) {
+			char ch = *c;
+			if (pointer && ch == '~') {
+				/* ~0 is '~' and ~1 is '/' */
+				if (c[1] != '0' && c[1] != '1') {
+					return JSON_ERROR_INVAL;
+				}
+				ch = (*++c == '0') ? '~' : '/';
+			}
+			if (used >= JSON_PATH_SIZE) {
+				return JSON_ERROR_NOMEM;
+			}
+			path->buffer[used++] = ch;
+		}
+		segment->length = used - segment->offset;
+		segment->hash = jsmne_hash(path->buffer + segment->offset, segment->length);
+
+		/* Array index: digits without leading zeros */
+		segment->index = -1;
+		if (segment->length > 0 && segment->length < 10 &&
+				(path->buffer[segment->offset] != '0' || segment->length == 1)) {
+			segment->index = 0;
+			for (i = 0; i < segment->length; i++) {
+				char d = path->buffer[segment->offset + i];
+				if (d < '0' || d > '9') {
+					segment->index = -1;
+					break;
+				}
+				segment->index = segment->index * 10 + (d - '0');
+			}
+		}
+		if (*c == '\0') {
+			return JSON_ERROR_OK;
+		}
+		c++;
+	}
+}
+
+/*
+ * Returns the index of the token selected by a compiled path, or -1.
+ */
+json_offset_t evalPath(parser_s *parser, const path_s *path) {
+	size_t index = 0;
+	int n;
+
+	if (!jsmne_need(parser, 0)) {
+		return -1;
+	}
+	for (n = 0; n < path->count; n++) {
+		const pathsegment_t *segment = &path->segments[n];
+		djson_type_e type = TOKEN_TYPE(&parser->tokens[index]);
+
+		if (type == JSON_OBJECT) {
+			json_offset_t value = jsmne_find_key(parser, index, path->buffer + segment->offset,
+					segment->length, segment->hash);
+			if (value < 0) {
+				return -1;
+			}
+			index = value;
+		} else if (type == JSON_ARRAY && segment->index >= 0) {
+			json_offset_t array = (json_offset_t) index;
+			long i;
+			jsmne_enter(parser, index);
+			index++;
+			for (i = 0; i < segment->index && jsmne_need(parser, index) &&
+					TOKEN_PARENT(&parser->tokens[index]) == array; i++) {
+				index = jsmne_skip(parser, index);
+			}
+			if (!jsmne_need(parser, index) || TOKEN_PARENT(&parser->tokens[index]) != array) {
+				return -1;
+			}
+		} else {
+			return -1;
+		}
+	}
+	return (json_offset_t) index;
+}
+
+/*
+ * Move behind the current token and everything inside of it.
+ */
+void skipToken(parser_s *parser) {
+	if (jsmne_need(parser, parser->counter)) {
+		parser->counter = jsmne_skip(parser, parser->counter);
+	}
+}
+
+/*
+ * Move to the next token with the same parent, e.g. the next key of an
+ * object or the next value of an array. Returns false if there is none.
+ */
+bool nextSibling(parser_s *parser) {
+	size_t next;
+	if (!jsmne_need(parser, parser->counter)) {
+		return false;
+	}
+	next = jsmne_skip(parser, parser->counter);
+	if (jsmne_need(parser, next) && TOKEN_PARENT(&parser->tokens[next]) == TOKEN_PARENT(&parser->tokens[parser->counter])) {
+		parser->counter = next;
+		return true;
+	}
+	return false;
+}
+
+size_t sizeOfTokens(parser_s *parser) {
+	jsmne_expand(parser);
+	return parser->length;
+}
+
+/*
+ * Compares length bytes of js with the terminated string s in one pass.
+ */
+static bool jsmne_equal(const char *js, size_t length, const char *s) {
+	size_t i;
+	for (i = 0; i < length; i++) {
+		if (s[i] != js[i] || s[i] == '\0') {
+			return false;
+		}
+	}
+	return s[length] == '\0';
+}
+
+/*
+ * Check if token is equal to a string.
+ */
+bool tokenEqualString(parser_s *parser, char *s) {
+	token_s *token = jsmne_token(parser, parser->counter);
+	return jsmne_equal(parser->json + token->start, token->end - token->start, s);
+}
+
+/*
+ * Return the string of the token. Terminates it inside the parsed JSON,
+ * which must be writable therefore.
+ */
+char* tokenToString(parser_s *parser) {
+	token_s *token = jsmne_token(parser, parser->counter);
+    ((char *) parser->json)[token->end] = '\0';
+    return (char *) parser->json + token->start;
+}
+
+/*
+ * Return the token at index as pointer and length, without changing the JSON.
+ * Strings are returned without quotes and escapes are not decoded.
+ */
+strview_s tokenAtToView(parser_s *parser, size_t index) {
+	strview_s view = { NULL, 0 };
+	if (jsmne_need(parser, index)) {
+		token_s *token = jsmne_token(parser, index);
+		view.string = parser->json + token->start;
+		/* An object or array which is not closed */
+		view.length = (token->end >= token->start) ? (size_t) (token->end - token->start) : 0;
+	}
+	return view;
+}
+
+/*
+ * Type, size and parent of the token at index, -1 if there is none. They
+ * work for both token layouts.
+ */
+int tokenAtType(parser_s *parser, size_t index) {
+	return jsmne_need(parser, index) ? (int) TOKEN_TYPE(&parser->tokens[index]) : -1;
+}
+
+json_offset_t tokenAtSize(parser_s *parser, size_t index) {
+	if (!jsmne_need(parser, index)) {
+		return -1;
+	}
+	if (TOKEN_TYPE(&parser->tokens[index]) == JSON_OBJECT || TOKEN_TYPE(&parser->tokens[index]) == JSON_ARRAY) {
+		return jsmne_size(parser, index, JSON_OFFSET_MAX);
+	}
+	return TOKEN_SIZE(&parser->tokens[index]);
+}
+
+json_offset_t tokenAtParent(parser_s *parser, size_t index) {
+	return jsmne_need(parser, index) ? TOKEN_PARENT(&parser->tokens[index]) : -1;
+}
+
+/*
+ * Return the current token as pointer and length.
+ */
+strview_s tokenToView(parser_s *parser) {
+	return tokenAtToView(parser, parser->counter);
+}
+
+/**
+ * Splits a JSON number into up to 19 significant digits and a decimal
+ * exponent. Returns the length of the number or 0 if the span is no
+ * valid number. *exact is false if digits were dropped.
+ */
+static size_t jsmne_number(const char *js, size_t length, bool *negative,
+		uint64_t *mantissa, int *exponent, bool *integer, bool *exact) {
+	size_t i = 0;
+	int digits = 0, dropped = 0, e = 0;
+	uint64_t w = 0;
+
+	*negative = (length > 0 && js[0] == '-');
+	if (*negative) i++;
+	if (i >= length || js[i] < '0' || js[i] > '9') return 0;
+	if (js[i] == '0') {
+		i++;
+	} else {
+		for (; i < length && js[i] >= '0' && js[i] <= '9'; i++) {
+			if (digits < 19) {
+				w = w * 10 + (uint64_t) (js[i] - '0');
+				digits++;
+			} else {
+				dropped++;
+			}
+		}
+	}
+	*integer = true;
+	*exact = true;
+	if (i < length && js[i] == '.') {
+		*integer = false;
+		if (++i >= length || js[i] < '0' || js[i] > '9') return 0;
+		for (; i < length && js[i] >= '0' && js[i] <= '9'; i++) {
+			if (digits < 19) {
+				if (w != 0 || js[i] != '0') digits++;
+				w = w * 10 + (uint64_t) (js[i] - '0');
+				dropped--;
+			} else if (js[i] != '0') {
+				*exact = false;
+			}
+		}
+	}
+	if (i < length && (js[i] == 'e' || js[i] == 'E')) {
+		bool minus = false;
+		*integer = false;
+		if (++i < length && (js[i] == '+' || js[i] == '-')) minus = (js[i++] == '-');
+		if (i >= length || js[i] < '0' || js[i] > '9') return 0;
+		for (; i < length && js[i] >= '0' && js[i] <= '9'; i++) {
+			if (e < 100000) e = e * 10 + (js[i] - '0');
+		}
+		if (minus) e = -e;
+	}
+	if (dropped > 0) *exact = false;
+	*mantissa = w;
+	*exponent = e + dropped;
+	return i;
+}
+
+static const double jsmne_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int jsmne_to_int64(const char *js, size_t length, int64_t *value) {
+	size_t i;
+	uint64_t w = 0;
+	bool negative;
+
+	negative = (length > 0 && js[0] == '-');
+	i = negative;
+	if (i >= length || (js[i] == '0' && length > i + 1)) {
+		return JSON_ERROR_INVAL;
+	}
+	for (; i < length; i++) {
+		unsigned int d = (unsigned int) (js[i] - '0');
+		if (d > 9 || w > (UINT64_MAX - d) / 10) {
+			return JSON_ERROR_INVAL;
+		}
+		w = w * 10 + d;
+	}
+	if (w > (uint64_t) INT64_MAX + negative) {
+		return JSON_ERROR_INVAL;
+	}
+	*value = negative ? (int64_t) (0 - w) : (int64_t) w;
+	return JSON_ERROR_OK;
+}
+
+/**
+ * Converts the current primitive token to a 64 bit integer. Returns
+ * JSON_ERROR_INVAL if it is no integer or out of range.
+ */
+int tokenToInt64(parser_s *parser, int64_t *value) {
+	token_s *token;
+
+	if (!jsmne_need(parser, parser->counter) || TOKEN_TYPE(&parser->tokens[parser->counter]) != JSON_PRIMITIVE) {
+		return JSON_ERROR_INVAL;
+	}
+	token = &parser->tokens[parser->counter];
+	return jsmne_to_int64(parser->json + token->start, token->end - token->start, value);
+}
+
+/**
+ * Converts a number. Numbers with up to 15 significant digits and a small
+ * exponent (prices, measurements) are converted exactly by one
+ * multiplication or division. Others are left to strtod with at most 800
+ * significant digits: halfway points between doubles have fewer than 770,
+ * so a 1 standing for the nonzero digits dropped behind them rounds the
+ * same. Returns JSON_ERROR_INVAL for numbers beyond the range of double,
+ * e.g. 1e400.
+ */
+static int jsmne_to_double(const char *js, size_t length, double *value) {
+	uint64_t w;
+	int e, n;
+	bool negative, integer, exact, fraction = false, dropped = false;
+	char buffer[800 + 16], *q = buffer;
+	size_t i = 0, digits = 0;
+	int64_t exponent = 0;
+	double d;
+
+	if (length == 0 || jsmne_number(js, length, &negative, &w, &e, &integer, &exact) != length) {
+		return JSON_ERROR_INVAL;
+	}
+
+	/* Clinger's fast path: w and 10^|e| are exact doubles, one rounding */
+#if FLT_EVAL_METHOD == 0
+	if (exact && w <= (1ULL << 53)) {
+		if (w == 0) {
+			*value = negative ? -0.0 : 0.0;
+			return JSON_ERROR_OK;
+		}
+		/* 1234e25 = 1234000e22 while the digits still fit */
+		if (e > 22 && e <= 22 + 15 && w <= (1ULL << 53) / (uint64_t) jsmne_pow10[e - 22]) {
+			w *= (uint64_t) jsmne_pow10[e - 22];
+			e = 22;
+		}
+		if (e >= -22 && e <= 22) {
+			d = (double) w;
+			d = (e < 0) ? d / jsmne_pow10[-e] : d * jsmne_pow10[e];
+			*value = negative ? -d : d;
+			return JSON_ERROR_OK;
+		}
+	}
+#endif
+
+	/* Digits and exponent without a decimal point, the same in any locale */
+	if (negative) {
+		*q++ = js[i++];
+	}
+	for (; i < length && js[i] != 'e' && js[i] != 'E'; i++) {
+		if (js[i] == '.') {
+			fraction = true;
+		} else if (digits == 0 && js[i] == '0') {
+			exponent -= fraction;
+		} else if (digits < sizeof(buffer) - 16) {
+			*q++ = js[i];
+			digits++;
+			exponent -= fraction;
+		} else {
+			dropped |= js[i] != '0';
+			exponent += !fraction;
+		}
+	}
+	if (digits == 0) {
+		*value = negative ? -0.0 : 0.0;
+		return JSON_ERROR_OK;
+	}
+	if (dropped) {
+		*q++ = '1';
+		exponent--;
+	}
+	if (i < length) {
+		bool minus = js[++i] == '-';
+		int64_t shift = 0;
+		if (js[i] == '-' || js[i] == '+') {
+			i++;
+		}
+		for (; i < length; i++) {
+			if (shift < 1000000000000000LL) {
+				shift = shift * 10 + (js[i] - '0');
+			}
+		}
+		exponent += minus ? -shift : shift;
+	}
+	/* Beyond this the number is 0 or infinite anyway */
+	e = (exponent > 99999) ? 99999 : (exponent < -99999) ? -99999 : (int) exponent;
+	*q++ = 'e';
+	if (e < 0) {
+		*q++ = '-';
+		e = -e;
+	}
+	n = 1;
+	while (n * 10 <= e) {
+		n *= 10;
+	}
+	for (; n > 0; n /= 10) {
+		*q++ = (char) ('0' + e / n % 10);
+	}
+	*q = '\0';
+	d = strtod(buffer, NULL);
+	/* strtod() gives +-HUGE_VAL */
+	if (d > DBL_MAX || d < -DBL_MAX) {
+		return JSON_ERROR_INVAL;
+	}
+	*value = d;
+	return JSON_ERROR_OK;
+}
+
+/**
+ * Converts the current primitive token to a double, see jsmne_to_double().
+ * Returns JSON_ERROR_INVAL if it is no number or overflows a double.
+ */
+int tokenToDouble(parser_s *parser, double *value) {
+	token_s *token;
+
+	if (!jsmne_need(parser, parser->counter) || TOKEN_TYPE(&parser->tokens[parser->counter]) != JSON_PRIMITIVE) {
+		return JSON_ERROR_INVAL;
+	}
+	token = &parser->tokens[parser->counter];
+	return jsmne_to_double(parser->json + token->start, token->end - token->start, value);
+}
+
+/**
+ * Converts the current token true or false to a bool. Returns JSON_ERROR_INVAL for
+ * any other token.
+ */
+int tokenToBool(parser_s *parser, bool *value) {
+	const char *js;
+	size_t length;
+
+	if (!jsmne_need(parser, parser->counter) || TOKEN_TYPE(&parser->tokens[parser->counter]) != JSON_PRIMITIVE) {
+		return JSON_ERROR_INVAL;
+	}
+	js = parser->json + parser->tokens[parser->counter].start;
+	length = parser->tokens[parser->counter].end - parser->tokens[parser->counter].start;
+	if (length == 4 && memcmp(js, "true", 4) == 0) {
+		*value = true;
+	} else if (length == 5 && memcmp(js, "false", 5) == 0) {
+		*value = false;
+	} else {
+		return JSON_ERROR_INVAL;
+	}
+	return JSON_ERROR_OK;
+}
+
+/*
+ * Checks the number grammar of JSON, -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+ */
+static bool jsmne_is_number(const char *js, size_t length) {
+	size_t i = (length > 0 && js[0] == '-') ? 1 : 0;
+	size_t digits;
+
+	if (i < length && js[i] == '0') {
+		i++;
+	} else {
+		digits = i;
+		while (i < length && js[i] >= '0' && js[i] <= '9') i++;
+		if (i == digits) return false;
+	}
+	if (i < length && js[i] == '.') {
+		digits = ++i;
+		while (i < length && js[i] >= '0' && js[i] <= '9') i++;
+		if (i == digits) return false;
+	}
+	if (i < length && (js[i] == 'e' || js[i] == 'E')) {
+		i++;
+		if (i < length && (js[i] == '+' || js[i] == '-')) i++;
+		digits = i;
+		while (i < length && js[i] >= '0' && js[i] <= '9') i++;
+		if (i == digits) return false;
+	}
+	return i == length;
+}
+
+/* What parseSAXJSON() expects next */
+typedef enum {
+	JSON_SAX_VALUE,						// a value, or ']' behind '['
+	JSON_SAX_KEY,						// a key, or '}' behind '{'
+	JSON_SAX_COLON,
+	JSON_SAX_NEXT,						// ',' or the end of the object or array
+	JSON_SAX_END						// nothing but whitespace
+} jsmne_sax_e;
+
+/**
+ * Parses a JSON without tokens, calling the callbacks of sax for every
+ * value and key. Memory is JSON_PARSE_DEPTH bytes on the stack, for any
+ * length of js. Exactly one root value is accepted, commas and colons are
+ * checked, and strings must not hold unescaped bytes below 0x20. Other bytes
+ * of strings are not checked, e.g. for valid UTF-8. Returns JSON_ERROR_ABORTED if a callback returned non-zero,
+ * JSON_ERROR_PART if js ends too early.
+ */
+int parseSAXJSON(const sax_s *sax, void *ctx, const char *js, size_t len) {
+	char stack[JSON_PARSE_DEPTH];
+	int depth = 0;
+	jsmne_sax_e expect = JSON_SAX_VALUE;
+	bool empty = false;
+	size_t pos, end;
+
+	for (pos = 0; pos < len; pos++) {
+		char c = js[pos];
+		bool close = empty;
+		int r = 0;
+
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			pos = jsmne_skip_space(js, pos, len) - 1;
+			continue;
+		}
+		empty = false;
+		switch (c) {
+			case '{': case '[':
+				if (expect != JSON_SAX_VALUE) {
+					return JSON_ERROR_INVAL;
+				}
+				if (depth >= JSON_PARSE_DEPTH) {
+					return JSON_ERROR_STACK_FULL;
+				}
+				if (c == '{') {
+					r = (sax->onObjectStart != NULL) ? sax->onObjectStart(ctx) : 0;
+				} else {
+					r = (sax->onArrayStart != NULL) ? sax->onArrayStart(ctx) : 0;
+				}
+				stack[depth++] = c;
+				expect = (c == '{') ? JSON_SAX_KEY : JSON_SAX_VALUE;
+				empty = true;
+				break;
+			case '}': case ']':
+				if (depth == 0 || stack[depth - 1] != (c == '}' ? '{' : '[') ||
+						(expect != JSON_SAX_NEXT && !close)) {
+					return JSON_ERROR_INVAL;
+				}
+				depth--;
+				if (c == '}') {
+					r = (sax->onObjectEnd != NULL) ? sax->onObjectEnd(ctx) : 0;
+				} else {
+					r = (sax->onArrayEnd != NULL) ? sax->onArrayEnd(ctx) : 0;
+				}
+				expect = (depth > 0) ? JSON_SAX_NEXT : JSON_SAX_END;
+				break;
+			case ',':
+				if (expect != JSON_SAX_NEXT) {
+					return JSON_ERROR_INVAL;
+				}
+				expect = (stack[depth - 1] == '{') ? JSON_SAX_KEY : JSON_SAX_VALUE;
+				break;
+			case ':':
+				if (expect != JSON_SAX_COLON) {
+					return JSON_ERROR_INVAL;
+				}
+				expect = JSON_SAX_VALUE;
+				break;
+			case '\"':
+				if (expect != JSON_SAX_VALUE && expect != JSON_SAX_KEY) {
+					return JSON_ERROR_INVAL;
+				}
+				r = jsmne_scan_string(js, pos, len, &end);
+				if (r != JSON_ERROR_OK) {
+					return r;
+				}
+				if (jsmne_has_control(js, pos + 1, end)) {
+					return JSON_ERROR_INVAL;
+				}
+				if (expect == JSON_SAX_KEY) {
+					r = (sax->onKey != NULL) ? sax->onKey(ctx, js + pos + 1, end - pos - 1) : 0;
+					expect = JSON_SAX_COLON;
+				} else {
+					r = (sax->onString != NULL) ? sax->onString(ctx, js + pos + 1, end - pos - 1) : 0;
+					expect = (depth > 0) ? JSON_SAX_NEXT : JSON_SAX_END;
+				}
+				pos = end;
+				break;
+			default: {
+				size_t length;
+
+				if (expect != JSON_SAX_VALUE || jsmne_scan_primitive(js, pos, len, &end) != JSON_ERROR_OK) {
+					return JSON_ERROR_INVAL;
+				}
+				length = end - pos;
+				if (length == 4 && memcmp(js + pos, "true", 4) == 0) {
+					r = (sax->onBoolean != NULL) ? sax->onBoolean(ctx, true) : 0;
+				} else if (length == 5 && memcmp(js + pos, "false", 5) == 0) {
+					r = (sax->onBoolean != NULL) ? sax->onBoolean(ctx, false) : 0;
+				} else if (length == 4 && memcmp(js + pos, "null", 4) == 0) {
+					r = (sax->onNull != NULL) ? sax->onNull(ctx) : 0;
+				} else if (jsmne_is_number(js + pos, length)) {
+					r = (sax->onNumber != NULL) ? sax->onNumber(ctx, js + pos, length) : 0;
+				} else {
+					return JSON_ERROR_INVAL;
+				}
+				expect = (depth > 0) ? JSON_SAX_NEXT : JSON_SAX_END;
+				pos = end - 1;
+				break;
+			}
+		}
+		if (r != 0) {
+			return JSON_ERROR_ABORTED;
+		}
+	}
+	return (expect == JSON_SAX_END) ? JSON_ERROR_OK : JSON_ERROR_PART;
+}
+
+/**
+ * Checks that js is one well-formed JSON, by the grammar of parseSAXJSON().
+ * No tokens are written and no lock is taken, memory does not depend on len.
+ */
+bool isValidJSON(const char *js, size_t len) {
+	static const sax_s none = { 0 };
+	return parseSAXJSON(&none, NULL, js, len) == JSON_ERROR_OK;
+}
+
+int beforeTokenType(parser_s *parser) {
+	if (parser->counter > 0)  {
+		return TOKEN_TYPE(&parser->tokens[parser->counter - 1]);
+	} else {
+		return -1;
+	}
+}
+
+int currentTokenType(parser_s *parser) {
+	if (jsmne_need(parser, parser->counter)) {
+		return TOKEN_TYPE(&parser->tokens[parser->counter]);
+	} else {
+		return -1;
+	}
+}
+
+int nextTokenType(parser_s *parser) {
+	if (jsmne_need(parser, parser->counter + 1))  {
+		return TOKEN_TYPE(&parser->tokens[parser->counter + 1]);
+	} else {
+		return -1;
+	}
+}
+
+struct struct_chunk_s {
+	struct struct_chunk_s *next;
+	size_t size;						/* bytes behind the header */
+};
+
+/**
+ * Prepares an arena which allocates from buffer first and then from chunks
+ * of JSON_ARENA_CHUNK bytes or more from grow. Both may be NULL.
+ */
+void initArenaJSON(arena_s *arena, void *buffer, size_t size, djson_realloc_f grow, void *growContext) {
+	arena->buffer = buffer;
+	arena->size = (buffer != NULL) ? size : 0;
+	arena->grow = grow;
+	arena->growContext = growContext;
+	arena->chunks = NULL;
+	resetArenaJSON(arena);
+}
+
+/**
+ * Releases everything allocated in the arena at once. The chunks are kept
+ * and used again.
+ */
+void resetArenaJSON(arena_s *arena) {
+	arena->chunk = NULL;
+	arena->next = arena->buffer;
+	arena->end = arena->buffer + arena->size;
+}
+
+/**
+ * Returns the chunks to grow.
+ */
+void freeArenaJSON(arena_s *arena) {
+	struct struct_chunk_s *chunk = arena->chunks;
+	while (chunk != NULL) {
+		struct struct_chunk_s *next = chunk->next;
+		arena->grow(arena->growContext, chunk, sizeof(*chunk) + chunk->size, 0);
+		chunk = next;
+	}
+	arena->chunks = NULL;
+	resetArenaJSON(arena);
+}
+
+static void *jsmne_arena_alloc(arena_s *arena, size_t size, size_t align) {
+	for (;;) {
+		struct struct_chunk_s *chunk;
+		if (arena->next != NULL) {
+			char *p = (char *) (((uintptr_t) arena->next + align - 1) & ~(uintptr_t) (align - 1));
+			if (p <= arena->end && (size_t) (arena->end - p) >= size) {
+				arena->next = p + size;
+				return p;
+			}
+		}
+		/* continue in the next kept chunk, or insert a new one before it */
+		chunk = (arena->chunk != NULL) ? arena->chunk->next : arena->chunks;
+		if (chunk == NULL || chunk->size < size + align) {
+			size_t bytes = (size + align > JSON_ARENA_CHUNK) ? size + align : JSON_ARENA_CHUNK;
+			if (arena->grow == NULL) {
+				return NULL;
+			}
+			chunk = arena->grow(arena->growContext, NULL, 0, sizeof(*chunk) + bytes);
+			if (chunk == NULL) {
+				return NULL;
+			}
+			chunk->size = bytes;
+			if (arena->chunk != NULL) {
+				chunk->next = arena->chunk->next;
+				arena->chunk->next = chunk;
+			} else {
+				chunk->next = arena->chunks;
+				arena->chunks = chunk;
+			}
+		}
+		arena->chunk = chunk;
+		arena->next = (char *) (chunk + 1);
+		arena->end = arena->next + chunk->size;
+	}
+}
+
+static char *jsmne_put_utf8(char *dst, unsigned int code) {
+	if (code < 0x80) {
+		*dst++ = (char) code;
+	} else if (code < 0x800) {
+		*dst++ = (char) (0xC0 | (code >> 6));
+		*dst++ = (char) (0x80 | (code & 0x3F));
+	} else if (code < 0x10000) {
+		*dst++ = (char) (0xE0 | (code >> 12));
+		*dst++ = (char) (0x80 | ((code >> 6) & 0x3F));
+		*dst++ = (char) (0x80 | (code & 0x3F));
+	} else {
+		*dst++ = (char) (0xF0 | (code >> 18));
+		*dst++ = (char) (0x80 | ((code >> 12) & 0x3F));
+		*dst++ = (char) (0x80 | ((code >> 6) & 0x3F));
+		*dst++ = (char) (0x80 | (code & 0x3F));
+	}
+	return dst;
+}
+
+static long jsmne_hex4(const char *js, size_t pos, size_t length) {
+	long code = 0;
+	size_t i;
+	if (pos + 4 > length) {
+		return -1;
+	}
+	for (i = pos; i < pos + 4; i++) {
+		char c = js[i];
+		code <<= 4;
+		if (c >= '0' && c <= '9') code |= c - '0';
+		else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+		else return -1;
+	}
+	return code;
+}
+
+/**
+ * Decodes the escapes of a string into dst, which needs length + 1 bytes.
+ * Invalid \u escapes become U+FFFD. Returns the decoded length.
+ */
+static size_t jsmne_decode(char *dst, const char *js, size_t length) {
+	char *d = dst;
+	size_t i = 0;
+
+	for (;;) {
+		const char *escape = memchr(js + i, '\\', length - i);
+		size_t run = (escape != NULL) ? (size_t) (escape - (js + i)) : length - i;
+		long code;
+
+		memcpy(d, js + i, run);
+		d += run;
+		i += run + 2;
+		if (escape == NULL || i > length) {
+			break;
+		}
+		switch (js[i - 1]) {
+			case 'b': *d++ = '\b'; break;
+			case 'f': *d++ = '\f'; break;
+			case 'n': *d++ = '\n'; break;
+			case 'r': *d++ = '\r'; break;
+			case 't': *d++ = '\t'; break;
+			case 'u':
+				code = jsmne_hex4(js, i, length);
+				i += 4;
+				if (code >= 0xD800 && code < 0xDC00 && i + 1 < length && js[i] == '\\' && js[i + 1] == 'u') {
+					long low = jsmne_hex4(js, i + 2, length);
+					if (low >= 0xDC00 && low < 0xE000) {
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+						i += 6;
+					}
+				}
+				if (code < 0 || (code >= 0xD800 && code < 0xE000)) {
+					code = 0xFFFD;
+				}
+				d = jsmne_put_utf8(d, (unsigned int) code);
+				break;
+			default: *d++ = js[i - 1]; break;
+		}
+		if (i >= length) {
+			break;
+		}
+	}
+	*d = '\0';
+	return d - dst;
+}
+
+static const char *jsmne_dom_string(parser_s *parser, arena_s *arena, token_s *token, uint32_t *length) {
+	size_t n = token->end - token->start;
+	char *string = jsmne_arena_alloc(arena, n + 1, 1);
+	if (string != NULL) {
+		*length = (uint32_t) jsmne_decode(string, parser->json + token->start, n);
+	}
+	return string;
+}
+
+/**
+ * Builds a tree of the whole parse in the arena, in one pass over the
+ * tokens. Strings get decoded, numbers converted. Returns JSON_ERROR_NOMEM
+ * if the arena is full, JSON_ERROR_PART for an unfinished parse and
+ * JSON_ERROR_INVAL for invalid primitives, keys without a value and
+ * values without a key, and for objects, arrays and strings whose count
+ * does not fit a node. Objects and arrays a lazy parse skipped are
+ * tokenized first. The tree lives until the arena is reset, the JSON is
+ * not needed.
+ */
+int buildDOM(parser_s *parser, arena_s *arena, node_s **root) {
+	struct {
+		node_s *node;
+		uint32_t filled;
+	} stack[JSON_PARSE_DEPTH + 1];
+	int depth = 0;
+	const char *key = NULL;
+	uint32_t keyLength = 0;
+	size_t i;
+
+	jsmne_expand(parser);
+	if (parser->error < 0) {
+		return parser->error;
+	}
+	if (parser->length == 0 || parser->state.depth > 0) {
+		return JSON_ERROR_PART;
+	}
+	*root = jsmne_arena_alloc(arena, sizeof(node_s), sizeof(void *));
+	if (*root == NULL) {
+		return JSON_ERROR_NOMEM;
+	}
+
+	for (i = 0; i < parser->length; i++) {
+		token_s *token = &parser->tokens[i];
+		const char *js = parser->json + token->start;
+		size_t length = token->end - token->start;
+		node_s *node;
+		json_offset_t size;
+
+		/* Strings and counts of nodes are 32 bit */
+		if ((uint64_t) length > UINT32_MAX) {
+			return JSON_ERROR_INVAL;
+		}
+		if (i == 0) {
+			node = *root;
+		} else if (depth == 0) {
+			/* Behind the root */
+			return JSON_ERROR_INVAL;
+		} else if (stack[depth - 1].node->type == JSON_NODE_OBJECT && key == NULL) {
+			if (TOKEN_TYPE(token) != JSON_STRING || TOKEN_SIZE(token) == 0) {
+				return JSON_ERROR_INVAL;
+			}
+			key = jsmne_dom_string(parser, arena, token, &keyLength);
+			if (key == NULL) {
+				return JSON_ERROR_NOMEM;
+			}
+			continue;
+		} else if (TOKEN_TYPE(token) == JSON_STRING && TOKEN_SIZE(token) > 0) {
+			/* A key where a value belongs */
+			return JSON_ERROR_INVAL;
+		} else {
+			node = &stack[depth - 1].node->value.children[stack[depth - 1].filled++];
+		}
+		node->key = key;
+		node->keyLength = keyLength;
+		node->hash = (key != NULL) ? jsmne_hash(key, keyLength) : 0;
+		key = NULL;
+
+		switch (TOKEN_TYPE(token)) {
+			case JSON_OBJECT:
+			case JSON_ARRAY:
+				size = jsmne_size(parser, i, JSON_OFFSET_MAX);
+				if (size < 0 || (uint64_t) size > UINT32_MAX) {
+					return JSON_ERROR_INVAL;
+				}
+				node->type = (TOKEN_TYPE(token) == JSON_OBJECT) ? JSON_NODE_OBJECT : JSON_NODE_ARRAY;
+				node->count = (uint32_t) size;
+				node->value.children = NULL;
+				if (size > 0) {
+					node->value.children = jsmne_arena_alloc(arena, size * sizeof(node_s), sizeof(void *));
+					if (node->value.children == NULL) {
+						return JSON_ERROR_NOMEM;
+					}
+					stack[depth].node = node;
+					stack[depth].filled = 0;
+					depth++;
+				}
+				break;
+			case JSON_STRING:
+				node->type = JSON_NODE_STRING;
+				node->value.string = jsmne_dom_string(parser, arena, token, &node->count);
+				if (node->value.string == NULL) {
+					return JSON_ERROR_NOMEM;
+				}
+				break;
+			default:
+				node->count = 0;
+				if (length == 4 && memcmp(js, "null", 4) == 0) {
+					node->type = JSON_NODE_NULL;
+				} else if ((length == 4 && memcmp(js, "true", 4) == 0) || (length == 5 && memcmp(js, "false", 5) == 0)) {
+					node->type = JSON_NODE_BOOLEAN;
+					node->value.boolean = (js[0] == 't');
+				} else if (jsmne_to_int64(js, length, &node->value.integer) == JSON_ERROR_OK) {
+					node->type = JSON_NODE_INTEGER;
+				} else if (jsmne_to_double(js, length, &node->value.number) == JSON_ERROR_OK) {
+					node->type = JSON_NODE_NUMBER;
+				} else {
+					return JSON_ERROR_INVAL;
+				}
+				break;
+		}
+		while (depth > 0 && stack[depth - 1].filled == stack[depth - 1].node->count) {
+			depth--;
+		}
+	}
+	/* Every object and array filled, no key left without its value */
+	if (depth > 0 || key != NULL) {
+		return JSON_ERROR_INVAL;
+	}
+	return JSON_ERROR_OK;
+}
+
+const node_s *getMemberN(const node_s *object, const char *key, size_t length) {
+	uint32_t hash;
+	uint32_t i;
+
+	if (object == NULL || object->type != JSON_NODE_OBJECT) {
+		return NULL;
+	}
+	hash = jsmne_hash(key, length);
+	for (i = 0; i < object->count; i++) {
+		const node_s *member = &object->value.children[i];
+		if (member->hash == hash && member->keyLength == length && memcmp(member->key, key, length) == 0) {
+			return member;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Returns the member of an object with the decoded key, or NULL.
+ */
+const node_s *getMember(const node_s *object, const char *key) {
+	return getMemberN(object, key, strlen(key));
+}
+
+/**
+ * Returns the element of an array at index, or NULL.
+ */
+const node_s *getElement(const node_s *array, size_t index) {
+	if (array == NULL || array->type != JSON_NODE_ARRAY || index >= array->count) {
+		return NULL;
+	}
+	return &array->value.children[index];
+}
+
+/**
+ * Prepares an unparser to write into the given buffer. If growBuffer is set,
+ * the buffer is enlarged with it when the JSON gets longer. buffer may be NULL then.
+ */
+void initUnparsingJSON(unparser_s *unparser, char *buffer, size_t size,
+		djson_realloc_f growBuffer, void *growContext) {
+	unparser->buffer = buffer;
+	unparser->size = (buffer != NULL) ? size : 0;
+	unparser->bufp = buffer;
+	unparser->growBuffer = growBuffer;
+	unparser->growContext = growContext;
+	unparser->flush = NULL;
+	unparser->flushContext = NULL;
+	unparser->escapeUnicode = 0;
+	unparser->error = JSON_ERROR_OK;
+	unparser->stackpos = 0;
+	unparser->isUnparsing = false;
+	#ifdef JSON_THREAD_SAFE
+	pthread_mutex_init (&unparser->mutex, NULL);
+	unparser->mutexInitialized = true;
+	#endif
+}
+
+/**
+ * Releases the output buffer with the growth callback, if there is one.
+ */
+void freeUnparsingJSON(unparser_s *unparser) {
+	if (unparser->growBuffer != NULL && unparser->buffer != NULL) {
+		unparser->growBuffer(unparser->growContext, unparser->buffer, unparser->size, 0);
+	}
+	unparser->buffer = NULL;
+	unparser->bufp = NULL;
+	unparser->size = 0;
+	#ifdef JSON_THREAD_SAFE
+	if (unparser->mutexInitialized == true) {
+		pthread_mutex_destroy (&unparser->mutex);
+		unparser->mutexInitialized = false;
+	}
+	#endif
+}
+
+/**
+ * Streams the output: whenever the buffer is full, it is passed to flush and
+ * reused, so a JSON of any length needs only the buffer. endJSON() flushes
+ * the rest.
+ */
+void setUnparsingFlush(unparser_s *unparser, djson_flush_f flush, void *flushContext) {
+	unparser->flush = flush;
+	unparser->flushContext = flushContext;
+}
+
+/**
+ * Strings are escaped as needed for valid JSON. With oneOrZero set, all
+ * non-ASCII characters are escaped as \uXXXX too.
+ */
+void setUnparsingEscapeUnicode(unparser_s *unparser, int oneOrZero) {
+	unparser->escapeUnicode = oneOrZero;
+}
+
+int startUnparsingJSON(unparser_s *unparser, djson_type_e rootType, djson_format_e isPretty) {
+	#ifdef JSON_THREAD_SAFE
+	pthread_mutex_lock (&unparser->mutex);
+	#endif
+
+	unparser->bufp= unparser->buffer;
+	unparser->nodeStack[0].nodeType= rootType;
+	unparser->nodeStack[0].elementNo= 0;
+	unparser->stackpos = 0;
+	unparser->error = JSON_ERROR_OK;
+	unparser->callNo = 1;
+	unparser->isPretty= isPretty;
+	unparser->isUnparsing = true;
+	jwPutch( unparser, (rootType==JSON_OBJECT) ? '{' : '[' );
+	return JSON_ERROR_OK;
+}
+
+int endUnparsingJSON(unparser_s *unparser) {
+	unparser->isUnparsing = false;
+	#ifdef JSON_THREAD_SAFE
+	pthread_mutex_unlock (&unparser->mutex);
+	#endif
+	return JSON_ERROR_OK;
+}
+
+/**
+ * Returns the JSON, NUL terminated after endJSON().
+ */
+char *getJSON(unparser_s *unparser) {
+	return unparser->buffer;
+}
+
+/**
+ * Returns the length of the JSON written so far without the terminator.
+ */
+size_t getJSONSize(unparser_s *unparser) {
+	return unparser->bufp - unparser->buffer;
+}
+
+/**
+ * Returns the JSON and its length. After endJSON() with a flush callback
+ * everything has been flushed and the view is empty.
+ */
+strview_s getJSONView(unparser_s *unparser) {
+	strview_s view;
+	view.string = unparser->buffer;
+	view.length = unparser->bufp - unparser->buffer;
+	return view;
+}
+
+/**
+ * Writes a NUL behind the JSON, which is not counted by getJSONSize().
+ */
+static void jwTerminate(unparser_s *unparser) {
+	if( (size_t)(unparser->bufp - unparser->buffer) >= unparser->size && !jwMakeRoom( unparser, 1 ) ) {
+		return;
+	}
+	*unparser->bufp = '\0';
+}
+
+/**
+ * Closes the root object or array and terminates the JSON. A fixed buffer
+ * needs one byte for the terminator.
+ */
+int endJSON(unparser_s *unparser) {
+	if( unparser->error == JSON_ERROR_OK ) {
+		if( unparser->stackpos == 0 ) {
+			djson_type_e node= unparser->nodeStack[0].nodeType;
+			if(unparser->isPretty) jwPutch( unparser, '\n' );
+			jwPutch( unparser, (node == JSON_OBJECT) ? '}' : ']');
+			if( unparser->flush != NULL && unparser->error == JSON_ERROR_OK ) jwFlush( unparser );
+			if( unparser->error == JSON_ERROR_OK ) jwTerminate( unparser );
+		} else {
+			unparser->error = JSON_ERROR_NEST_ERROR;	// nesting error, not all objects closed when unparserlose() called
+		}
+	}
+	return unparser->error;
+}
+
+int endObject(unparser_s *unparser) {
+	if( unparser->error == JSON_ERROR_OK ) {
+		djson_type_e node;
+		int lastElemNo= unparser->nodeStack[unparser->stackpos].elementNo;
+		node= jwPop( unparser );
+		if( lastElemNo > 0 ) jwPretty( unparser );
+		jwPutch( unparser, (node == JSON_OBJECT) ? '}' : ']');
+	}
+	return unparser->error;
+}
+
+int endArray(unparser_s *unparser) {
+	if( unparser->error == JSON_ERROR_OK ) {
+		djson_type_e node;
+		int lastElemNo= unparser->nodeStack[unparser->stackpos].elementNo;
+		node= jwPop( unparser );
+		if( lastElemNo > 0 ) jwPretty( unparser );
+		jwPutch( unparser, (node == JSON_OBJECT) ? '}' : ']');
+	}
+	return unparser->error;
+}
+
+int getError(unparser_s *unparser) {
+	return unparser->callNo;
+}
+
+void addRawTextToObject(unparser_s *unparser, char *key, char *rawtext) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutraw( unparser, rawtext);
+}
+
+void addStringToObject(unparser_s *unparser, char *key, char *value) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutstr( unparser, value );
+}
+
+void addRawTextToObjectN(unparser_s *unparser, const char *key, size_t keylen, const char *rawtext, size_t len) {
+	if(_jwObjN( unparser, key, keylen ) == JSON_ERROR_OK) jwPutn( unparser, rawtext, len );
+}
+
+void addStringToObjectN(unparser_s *unparser, const char *key, size_t keylen, const char *value, size_t vallen) {
+	if(_jwObjN( unparser, key, keylen ) == JSON_ERROR_OK) jwPutstrn( unparser, value, vallen );
+}
+
+void addIntegerToObject(unparser_s *unparser, char *key, int value) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPuti64( unparser, value );
+}
+
+void addInt64ToObject(unparser_s *unparser, char *key, int64_t value) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPuti64( unparser, value );
+}
+
+void addUInt64ToObject(unparser_s *unparser, char *key, uint64_t value) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutu64( unparser, value, false );
+}
+
+void addDoubleToObject(unparser_s *unparser, char *key, double value) {
+	grisu_dtoa( value, unparser->tmpbuf );
+	addRawTextToObject( unparser, key, unparser->tmpbuf );
+}
+
+void addFixedDoubleToObject(unparser_s *unparser, char *key, double value, int decimals) {
+	modp_dtoa2( value, unparser->tmpbuf, decimals );
+	addRawTextToObject( unparser, key, unparser->tmpbuf );
+}
+
+void addBooleanToObject(unparser_s *unparser, char *key, int oneOrZero) {
+	addRawTextToObject( unparser, key, (oneOrZero) ? "true" : "false" );
+}
+
+void addNullToObject(unparser_s *unparser, char *key) {
+	addRawTextToObject( unparser, key, "null" );
+}
+
+void addObjectToObject(unparser_s *unparser, char *key) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) {
+		jwPutch( unparser, '{' );
+		jwPush( unparser, JSON_OBJECT );
+	}
+}
+
+void addArrayToObject(unparser_s *unparser, char *key) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) {
+		jwPutch( unparser, '[' );
+		jwPush( unparser, JSON_ARRAY );
+	}
+}
+
+void addRawTextToArray(unparser_s *unparser, char *rawtext) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutraw( unparser, rawtext);
+}
+
+void addStringToArray(unparser_s *unparser, char *value) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutstr( unparser, value );
+}
+
+void addRawTextToArrayN(unparser_s *unparser, const char *rawtext, size_t len) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutn( unparser, rawtext, len );
+}
+
+void addStringToArrayN(unparser_s *unparser, const char *value, size_t vallen) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutstrn( unparser, value, vallen );
+}
+
+void addIntegerToArray(unparser_s *unparser, int value) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPuti64( unparser, value );
+}
+
+void addInt64ToArray(unparser_s *unparser, int64_t value) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPuti64( unparser, value );
+}
+
+void addUInt64ToArray(unparser_s *unparser, uint64_t value) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutu64( unparser, value, false );
+}
+
+void addDoubleToArray(unparser_s *unparser, double value) {
+	grisu_dtoa( value, unparser->tmpbuf );
+	addRawTextToArray( unparser, unparser->tmpbuf );
+}
+
+void addFixedDoubleToArray(unparser_s *unparser, double value, int decimals) {
+	modp_dtoa2( value, unparser->tmpbuf, decimals );
+	addRawTextToArray( unparser, unparser->tmpbuf );
+}
+
+void addBooleanToArray(unparser_s *unparser, int oneOrZero) {
+	addRawTextToArray( unparser,  (oneOrZero) ? "true" : "false" );
+}
+
+void addNullToArray(unparser_s *unparser) {
+	addRawTextToArray( unparser,  "null" );
+}
+
+void addObjectToArray(unparser_s *unparser) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) {
+		jwPutch( unparser, '{' );
+		jwPush( unparser, JSON_OBJECT );
+	}
+}
+
+void addArrayToArray(unparser_s *unparser) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) {
+		jwPutch( unparser, '[' );
+		jwPush( unparser, JSON_ARRAY );
+	}
+}
+
+/**
+ * Escapes every key once into a fragment ,"key": from which the members of
+ * compact and of pretty objects are cut out. Keys are always escaped to
+ * ASCII, which is valid with and without setUnparsingEscapeUnicode().
+ */
+int compileShape(shape_s *shape, const char *const *keys, int count) {
+	unparser_s unparser;
+	int error;
+	int i;
+
+	shape->count = 0;
+	if( count < 0 || count > JSON_SHAPE_KEYS ) {
+		return JSON_ERROR_NOMEM;
+	}
+	initUnparsingJSON( &unparser, shape->buffer, JSON_SHAPE_SIZE, NULL, NULL );
+	unparser.escapeUnicode = 1;
+	for( i = 0; i < count; i++ ) {
+		shape->offsets[i] = (size_t)(unparser.bufp - unparser.buffer);
+		jwPutch( &unparser, ',' );
+		jwPutstr( &unparser, keys[i] );
+		jwPutn( &unparser, ": ", 2 );
+	}
+	shape->offsets[count] = (size_t)(unparser.bufp - unparser.buffer);
+	error = unparser.error;
+	freeUnparsingJSON( &unparser );
+	if( error != JSON_ERROR_OK ) {
+		return JSON_ERROR_NOMEM;
+	}
+	shape->count = count;
+	return JSON_ERROR_OK;
+}
+
+/**
+ * Returns the most bytes a scalar node can take, 0 for arrays and objects.
+ */
+static size_t jwNodeBound(const node_s *node) {
+	switch( node->type ) {
+		case JSON_NODE_NULL:
+		case JSON_NODE_BOOLEAN:	return 5;
+		case JSON_NODE_INTEGER:	return 20;
+		case JSON_NODE_NUMBER:	return sizeof(((unparser_s *) 0)->tmpbuf);
+		case JSON_NODE_STRING:	return 6 * (size_t) node->count + 2;	/* every byte as \uXXXX */
+		default:				return 0;
+	}
+}
+
+static void jwPutNode(unparser_s *unparser, const node_s *node) {
+	uint32_t i;
+
+	switch( node->type ) {
+		case JSON_NODE_NULL:	jwPutn( unparser, "null", 4 ); break;
+		case JSON_NODE_BOOLEAN:	jwPutraw( unparser, (node->value.boolean) ? "true" : "false" ); break;
+		case JSON_NODE_INTEGER:	jwPuti64( unparser, node->value.integer ); break;
+		case JSON_NODE_NUMBER:
+			grisu_dtoa( node->value.number, unparser->tmpbuf );
+			jwPutraw( unparser, unparser->tmpbuf );
+			break;
+		case JSON_NODE_STRING:	jwPutstrn( unparser, node->value.string, node->count ); break;
+		case JSON_NODE_ARRAY:
+			jwPutch( unparser, '[' );
+			jwPush( unparser, JSON_ARRAY );
+			for( i = 0; i < node->count && _jwArr( unparser ) == JSON_ERROR_OK; i++ )
+				jwPutNode( unparser, &node->value.children[i] );
+			endArray( unparser );
+			break;
+		case JSON_NODE_OBJECT:
+			jwPutch( unparser, '{' );
+			jwPush( unparser, JSON_OBJECT );
+			for( i = 0; i < node->count; i++ ) {
+				const node_s *member = &node->value.children[i];
+				if( _jwObjN( unparser, member->key, member->keyLength ) != JSON_ERROR_OK ) break;
+				jwPutNode( unparser, member );
+			}
+			endObject( unparser );
+			break;
+	}
+}
+
+/**
+ * Writes an object of the shape with values[i] for key i. Room for the
+ * whole object is made at once, then the key fragments are copied without
+ * checks until a nested array or object, which may flush the buffer.
+ */
+static void jwPutShaped(unparser_s *unparser, const shape_s *shape, const node_s *values) {
+	size_t indent, bound, room;
+	bool reserved;
+	int i;
+
+	jwPutch( unparser, '{' );
+	jwPush( unparser, JSON_OBJECT );
+	if( unparser->error != JSON_ERROR_OK ) return;
+	unparser->nodeStack[unparser->stackpos].elementNo = shape->count;
+	unparser->callNo += shape->count;
+
+	indent = (unparser->isPretty) ? 1 + 4 * (size_t)(unparser->stackpos + 1) : 0;
+	bound = shape->offsets[shape->count] + (shape->count + 1) * indent + 1;
+	for( i = 0; i < shape->count; i++ )
+		bound += jwNodeBound( &values[i] );
+	/* a fixed buffer which is too small is still filled up to the last byte */
+	room = unparser->size - (size_t)(unparser->bufp - unparser->buffer);
+	reserved = room >= bound || ((unparser->growBuffer != NULL ||
+			(unparser->flush != NULL && unparser->size >= bound)) && jwMakeRoom( unparser, bound ));
+	if( unparser->error != JSON_ERROR_OK ) return;
+
+	for( i = 0; i < shape->count; i++ ) {
+		const char *fragment = shape->buffer + shape->offsets[i];
+		size_t length = shape->offsets[i + 1] - shape->offsets[i];
+		if( unparser->isPretty ) {
+			if( i > 0 ) jwPutch( unparser, ',' );
+			jwPretty( unparser );
+			fragment++;
+			length--;
+		} else if( i == 0 ) {
+			fragment++;
+			length -= 2;
+		} else {
+			length--;
+		}
+		if( reserved ) {
+			memcpy( unparser->bufp, fragment, length );
+			unparser->bufp += length;
+		} else {
+			jwPutn( unparser, fragment, length );
+		}
+		jwPutNode( unparser, &values[i] );
+		if( values[i].type == JSON_NODE_ARRAY || values[i].type == JSON_NODE_OBJECT ) reserved = false;
+		if( unparser->error != JSON_ERROR_OK ) return;
+	}
+	endObject( unparser );
+}
+
+void addShapedToObject(unparser_s *unparser, char *key, const shape_s *shape, const node_s *values) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutShaped( unparser, shape, values );
+}
+
+void addShapedToArray(unparser_s *unparser, const shape_s *shape, const node_s *values) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutShaped( unparser, shape, values );
+}
+
+/* Element types of the array writers */
+typedef enum {
+	JSON_VALUES_INT,
+	JSON_VALUES_INT64,
+	JSON_VALUES_DOUBLE,
+	JSON_VALUES_BOOL,
+	JSON_VALUES_STRING
+} jw_values_e;
+
+/**
+ * Returns for how many of count elements of at most each bytes there is
+ * room, after making room for all of them with a growth callback or for
+ * a full buffer with a flush callback. 0 if a fixed buffer is short.
+ */
+static size_t jwReserve(unparser_s *unparser, size_t each, size_t count) {
+	size_t fit = (unparser->size - (size_t)(unparser->bufp - unparser->buffer)) / each;
+
+	if( fit >= count ) return count;
+	if( unparser->growBuffer != NULL ) {
+		return jwMakeRoom( unparser, each * count ) ? count : 0;
+	}
+	if( fit == 0 && unparser->flush != NULL && unparser->size >= each && jwMakeRoom( unparser, each ) ) {
+		fit = unparser->size / each;
+	}
+	return (fit < count) ? fit : count;
+}
+
+/**
+ * Writes element i of values with checks.
+ */
+static void jwPutValue(unparser_s *unparser, jw_values_e type, const void *values, size_t i) {
+	switch( type ) {
+		case JSON_VALUES_INT:		jwPuti64( unparser, ((const int *) values)[i] ); break;
+		case JSON_VALUES_INT64:		jwPuti64( unparser, ((const int64_t *) values)[i] ); break;
+		case JSON_VALUES_DOUBLE:
+			grisu_dtoa( ((const double *) values)[i], unparser->tmpbuf );
+			jwPutraw( unparser, unparser->tmpbuf );
+			break;
+		case JSON_VALUES_BOOL:
+			if( ((const bool *) values)[i] ) jwPutn( unparser, "true", 4 );
+			else jwPutn( unparser, "false", 5 );
+			break;
+		case JSON_VALUES_STRING:
+			jwPutstrn( unparser, ((const strview_s *) values)[i].string, ((const strview_s *) values)[i].length );
+			break;
+	}
+}
+
+static char *jwSeparate(char *p, const char *separator, size_t length) {
+	if( length == 1 ) {
+		*p++ = ',';
+		return p;
+	}
+	memcpy( p, separator, length );
+	return p + length;
+}
+
+/**
+ * Writes an array of n values. The separator with the indentation is built
+ * once, and numbers and booleans are formatted into reserved room without
+ * checks. Strings go through jwPutstrn(), which needs no checks either
+ * after one reservation with a growth callback.
+ */
+static void jwPutValues(unparser_s *unparser, jw_values_e type, const void *values, size_t n) {
+	static const size_t bounds[] = { 11, 20, sizeof(((unparser_s *) 0)->tmpbuf), 5, 0 };
+	char separator[2 + 4 * JSON_STACK_DEPTH];
+	size_t length = 1, each, i;
+	int level;
+
+	jwPutch( unparser, '[' );
+	jwPush( unparser, JSON_ARRAY );
+	if( unparser->error != JSON_ERROR_OK ) return;
+	separator[0] = ',';
+	if( unparser->isPretty ) {
+		separator[length++] = '\n';
+		for( level = 0; level < unparser->stackpos + 1; level++, length += 4 )
+			memcpy( separator + length, "    ", 4 );
+	}
+	each = bounds[type] + length;
+	if( type == JSON_VALUES_STRING && unparser->growBuffer != NULL ) {
+		size_t total = (size_t) length + 2;
+		for( i = 0; i < n; i++ )
+			total += length + 6 * ((const strview_s *) values)[i].length + 2;
+		if( unparser->size - (size_t)(unparser->bufp - unparser->buffer) < total && !jwMakeRoom( unparser, total ) ) return;
+	}
+
+	for( i = 0; i < n && unparser->error == JSON_ERROR_OK; ) {
+		/* the first element has no comma and is written with checks */
+		size_t fit = (i > 0 && type != JSON_VALUES_STRING) ? jwReserve( unparser, each, n - i ) : 0;
+		size_t end = i + fit;
+		char *p = unparser->bufp;
+
+		if( fit == 0 ) {
+			if( i > 0 ) jwPutn( unparser, separator, length );
+			else jwPutn( unparser, separator + 1, length - 1 );
+			jwPutValue( unparser, type, values, i++ );
+			continue;
+		}
+		switch( type ) {
+			case JSON_VALUES_INT:
+			case JSON_VALUES_INT64:
+				for( ; i < end; i++ ) {
+					int64_t value = (type == JSON_VALUES_INT) ? ((const int *) values)[i] : ((const int64_t *) values)[i];
+					uint64_t magnitude = (value < 0) ? 0 - (uint64_t) value : (uint64_t) value;
+					size_t digits = jwCountDigits( magnitude ) + (value < 0);
+					p = jwSeparate( p, separator, length );
+					jwFormatu64( p + digits, magnitude, value < 0 );
+					p += digits;
+				}
+				break;
+			case JSON_VALUES_DOUBLE:
+				for( ; i < end; i++ ) {
+					p = jwSeparate( p, separator, length );
+					grisu_dtoa( ((const double *) values)[i], p );
+					p += strlen( p );
+				}
+				break;
+			case JSON_VALUES_BOOL:
+				for( ; i < end; i++ ) {
+					bool value = ((const bool *) values)[i];
+					p = jwSeparate( p, separator, length );
+					memcpy( p, (value) ? "true" : "false", 5 );
+					p += (value) ? 4 : 5;
+				}
+				break;
+			case JSON_VALUES_STRING:
+				break;
+		}
+		unparser->bufp = p;
+	}
+	unparser->nodeStack[unparser->stackpos].elementNo = (n > 0);
+	unparser->callNo += (int) n;
+	endArray( unparser );
+}
+
+void addIntegerArrayToObject(unparser_s *unparser, char *key, const int *values, size_t n) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_INT, values, n );
+}
+
+void addInt64ArrayToObject(unparser_s *unparser, char *key, const int64_t *values, size_t n) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_INT64, values, n );
+}
+
+void addDoubleArrayToObject(unparser_s *unparser, char *key, const double *values, size_t n) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_DOUBLE, values, n );
+}
+
+void addBooleanArrayToObject(unparser_s *unparser, char *key, const bool *values, size_t n) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_BOOL, values, n );
+}
+
+void addStringArrayToObject(unparser_s *unparser, char *key, const strview_s *values, size_t n) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_STRING, values, n );
+}
+
+void addIntegerArrayToArray(unparser_s *unparser, const int *values, size_t n) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_INT, values, n );
+}
+
+void addInt64ArrayToArray(unparser_s *unparser, const int64_t *values, size_t n) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_INT64, values, n );
+}
+
+void addDoubleArrayToArray(unparser_s *unparser, const double *values, size_t n) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_DOUBLE, values, n );
+}
+
+void addBooleanArrayToArray(unparser_s *unparser, const bool *values, size_t n) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_BOOL, values, n );
+}
+
+void addStringArrayToArray(unparser_s *unparser, const strview_s *values, size_t n) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutValues( unparser, JSON_VALUES_STRING, values, n );
+}
+
+/**
+ * Finds the bytes of the token at index, strings with their quotes. False
+ * if there is no such token or its object or array is not closed yet.
+ */
+static bool jsmne_span(parser_s *parser, size_t index, strview_s *span) {
+	token_s *token;
+	bool quoted;
+
+	if (!jsmne_need(parser, index)) {
+		return false;
+	}
+	token = &parser->tokens[index];
+	if (TOKEN_TYPE(token) == JSON_OBJECT || TOKEN_TYPE(token) == JSON_ARRAY) {
+		/* Closes an object or array which a lazy parse has not reached */
+		jsmne_skip(parser, index);
+		token = &parser->tokens[index];
+		if (TOKEN_SKIP(token) < 0) {
+			return false;
+		}
+	}
+	quoted = (TOKEN_TYPE(token) == JSON_STRING);
+	span->string = parser->json + token->start - quoted;
+	span->length = (size_t) (token->end - token->start) + 2 * quoted;
+	return true;
+}
+
+static void jwIndent(unparser_s *unparser, size_t level) {
+	if( unparser->isPretty ) {
+		jwPutch( unparser, '\n' );
+		while( level-- > 0 )
+			jwPutn( unparser, "    ", 4 );
+	}
+}
+
+/**
+ * Writes JSON in the format of the unparser: whitespace between the
+ * tokens is dropped and, for pretty output, written as by the unparser.
+ * Strings and primitives are copied as they are, a primitive with bytes
+ * the tokenizer rejects stops with JSON_ERROR_INVAL.
+ */
+static void jwPutFormatted(unparser_s *unparser, const char *js, size_t len) {
+	size_t level = (size_t) unparser->stackpos + 1;
+	size_t pos = 0, end;
+
+	while( pos < len && unparser->error == JSON_ERROR_OK ) {
+		switch( js[pos] ) {
+			case ' ': case '\t': case '\n': case '\r':
+				pos++;
+				break;
+			case '\"':
+				end = jsmne_find_string_end( js, pos + 1, len );
+				while( end < len && js[end] == '\\' )
+					end = jsmne_find_string_end( js, end + 2, len );
+				end = (end < len) ? end + 1 : len;
+				jwPutn( unparser, js + pos, end - pos );
+				pos = end;
+				break;
+			case '{': case '[':
+				jwPutch( unparser, js[pos] );
+				for( pos++; pos < len && (js[pos] == ' ' || js[pos] == '\t' || js[pos] == '\n' || js[pos] == '\r'); pos++ );
+				if( pos < len && (js[pos] == '}' || js[pos] == ']') ) {
+					jwPutch( unparser, js[pos++] );
+				} else {
+					jwIndent( unparser, ++level );
+				}
+				break;
+			case '}': case ']':
+				jwIndent( unparser, --level );
+				jwPutch( unparser, js[pos++] );
+				break;
+			case ',':
+				jwPutch( unparser, ',' );
+				jwIndent( unparser, level );
+				pos++;
+				break;
+			case ':':
+				jwPutch( unparser, ':' );
+				if( unparser->isPretty ) jwPutch( unparser, ' ' );
+				pos++;
+				break;
+			default:
+				/* A lazy parse only bracket matched skipped values */
+				end = pos;
+				if( jsmne_scan_primitive( js, pos, len, &end ) != JSON_ERROR_OK ) {
+					unparser->error = JSON_ERROR_INVAL;
+					return;
+				}
+				if( end == pos ) end = pos + 1;
+				jwPutn( unparser, js + pos, end - pos );
+				pos = end;
+				break;
+		}
+	}
 }
 
-void addStringToArray(unparser_s *unparser, char *value) {
-	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutstr( unparser, value );
+/**
+ * Writes a key which is quoted and escaped already.
+ */
+static int _jwObjRaw(unparser_s *unparser, const char *key, size_t keylen) {
+	if(unparser->error == JSON_ERROR_OK) {
+		unparser->callNo++;
+		if(unparser->nodeStack[unparser->stackpos].nodeType != JSON_OBJECT)
+			unparser->error = JSON_ERROR_NOT_OBJECT;			// tried to write Object key/value into Array
+		else if( unparser->nodeStack[unparser->stackpos].elementNo++ > 0 )
+			jwPutch( unparser, ',' );
+		jwPretty( unparser );
+		jwPutn( unparser, key, keylen );
+		jwPutch( unparser, ':' );
+		if(unparser->isPretty)
+			jwPutch( unparser, ' ' );
+	}
+	return unparser->error;
 }
 
-void addIntegerToArray(unparser_s *unparser, int value) {
-	modp_itoa10( value, unparser->tmpbuf );
-	addRawTextToArray( unparser, unparser->tmpbuf );
+/**
+ * Writes the token at index with everything inside of it, JSON_ERROR_PART if
+ * it is not complete.
+ */
+static void jwPutToken(unparser_s *unparser, parser_s *parser, size_t index, int reformat) {
+	strview_s span;
+
+	if( !jsmne_span( parser, index, &span ) ) {
+		unparser->error = JSON_ERROR_PART;
+	} else if( reformat ) {
+		jwPutFormatted( unparser, span.string, span.length );
+	} else {
+		jwPutn( unparser, span.string, span.length );
+	}
 }
 
-void addDoubleToArray(unparser_s *unparser, double value) {
-	modp_dtoa2( value, unparser->tmpbuf, 6 );
-	addRawTextToArray( unparser, unparser->tmpbuf );
+/**
+ * Copies the bytes of a token and everything inside of it, e.g. an object
+ * which a lazy parse skipped, as they are in the JSON.
+ */
+void addTokenToObject(unparser_s *unparser, char *key, parser_s *parser, size_t index) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutToken( unparser, parser, index, 0 );
 }
 
-void addBooleanToArray(unparser_s *unparser, int oneOrZero) {
-	addRawTextToArray( unparser,  (oneOrZero) ? "true" : "false" );
+void addTokenToArray(unparser_s *unparser, parser_s *parser, size_t index) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutToken( unparser, parser, index, 0 );
 }
 
-void addNullToArray(unparser_s *unparser) {
-	addRawTextToArray( unparser,  "null" );
+/**
+ * Copies a token like addTokenToObject(), but compact or pretty like the
+ * output of the unparser.
+ */
+void addFormattedTokenToObject(unparser_s *unparser, char *key, parser_s *parser, size_t index) {
+	if(_jwObj( unparser, key ) == JSON_ERROR_OK) jwPutToken( unparser, parser, index, 1 );
 }
 
-void addObjectToArray(unparser_s *unparser) {
-	if(_jwArr( unparser ) == JSON_ERROR_OK) {
-		jwPutch( unparser, '{' );
-		jwPush( unparser, JSON_OBJECT );
-	}
+void addFormattedTokenToArray(unparser_s *unparser, parser_s *parser, size_t index) {
+	if(_jwArr( unparser ) == JSON_ERROR_OK) jwPutToken( unparser, parser, index, 1 );
 }
 
-void addArrayToArray(unparser_s *unparser) {
-	if(_jwArr( unparser ) == JSON_ERROR_OK) {
-		jwPutch( unparser, '[' );
-		jwPush( unparser, JSON_ARRAY );
+/**
+ * Copies the members or elements of the object or array at index into the
+ * object or array the unparser has open. hook, if set, is called with the
+ * key of each member or with each element first and decides whether it is
+ * copied; it may write other members or elements before. Values are copied
+ * as they are or, with reformat, in the format of the unparser.
+ */
+int transcodeJSON(unparser_s *unparser, parser_s *parser, size_t index, int reformat,
+		djson_transcode_f hook, void *ctx) {
+	djson_type_e type;
+	size_t i;
+
+	if( !jsmne_need( parser, index ) ) {
+		return JSON_ERROR_INVAL;
+	}
+	type = TOKEN_TYPE(&parser->tokens[index]);
+	if( type != JSON_OBJECT && type != JSON_ARRAY ) {
+		return JSON_ERROR_INVAL;
+	}
+	jsmne_enter( parser, index );
+	for( i = index + 1; unparser->error == JSON_ERROR_OK && jsmne_need( parser, i ) &&
+			TOKEN_PARENT(&parser->tokens[i]) == (json_offset_t) index; i = jsmne_skip( parser, i ) ) {
+		int action = (hook != NULL) ? hook( ctx, unparser, parser, i ) : JSON_TRANSCODE_KEEP;
+		strview_s key;
+
+		if( action == JSON_TRANSCODE_ABORT ) {
+			return JSON_ERROR_ABORTED;
+		}
+		if( action != JSON_TRANSCODE_KEEP ) {
+			continue;
+		}
+		if( type == JSON_ARRAY ) {
+			if( _jwArr( unparser ) == JSON_ERROR_OK ) jwPutToken( unparser, parser, i, reformat );
+		} else if( jsmne_span( parser, i, &key ) &&
+				_jwObjRaw( unparser, key.string, key.length ) == JSON_ERROR_OK ) {
+			jwPutToken( unparser, parser, i + 1, reformat );
+		}
 	}
+	return unparser->error;
 }
 
 char *errorToString(int err) {
@@ -806,9 +3773,601 @@ char *errorToString(int err) {
 		case JSON_ERROR_BUF_FULL:  	return "Output buffer full.";
 		case JSON_ERROR_NOT_ARRAY:		return "Tried to write Array value into Object.";
 		case JSON_ERROR_NOT_OBJECT:	return "Tried to write Object key/value into Array.";
-		case JSON_ERROR_STACK_FULL:	return "Array/object nesting > JSON_STACK_DEPTH.";
+		case JSON_ERROR_STACK_FULL:	return "Array/object nesting > JSON_STACK_DEPTH or JSON_PARSE_DEPTH.";
 		case JSON_ERROR_STACK_EMPTY:	return "Stack underflow error (too many 'end's).";
 		case JSON_ERROR_NEST_ERROR:	return "Nesting error, not all objects closed when endUnparsingJSON() called.";
+		case JSON_ERROR_FLUSH:			return "Flush callback failed.";
+		case JSON_ERROR_TOO_LARGE:		return "JSON too large, see JSON_LARGE_DOCUMENTS.";
+		case JSON_ERROR_ABORTED:		return "Aborted by a callback.";
 	}
 	return "Unknown error.";
 }
+
+#if defined(_MSC_VER)
+	#define JSON_TRY_ACQUIRE(flag) (*(volatile long *) (flag) == 0 && _InterlockedCompareExchange((volatile long *) (flag), 1, 0) == 0)
+	#define JSON_RELEASE(flag) _InterlockedExchange((volatile long *) (flag), 0)
+#else
+	#define JSON_TRY_ACQUIRE(flag) (__atomic_load_n((flag), __ATOMIC_RELAXED) == 0 && \
+			__atomic_exchange_n((flag), 1, __ATOMIC_ACQUIRE) == 0)
+	#define JSON_RELEASE(flag) __atomic_store_n((flag), 0, __ATOMIC_RELEASE)
+#endif
+
+/**
+ * Prepares JSON_POOL_SIZE parsers and unparsers which get their tokens and
+ * buffers from grow on first use and keep them from then on.
+ */
+void initPoolJSON(pool_s *pool, djson_realloc_f grow, void *growContext) {
+	int i;
+	for (i = 0; i < JSON_POOL_SIZE; i++) {
+		initParsingJSON(&pool->parsers[i], NULL, 0, grow, growContext);
+		initUnparsingJSON(&pool->unparsers[i], NULL, 0, grow, growContext);
+		pool->parserBusy[i] = 0;
+		pool->unparserBusy[i] = 0;
+	}
+}
+
+/**
+ * Releases all tokens and buffers, no parser or unparser may be acquired.
+ */
+void freePoolJSON(pool_s *pool) {
+	int i;
+	for (i = 0; i < JSON_POOL_SIZE; i++) {
+		freeParsingJSON(&pool->parsers[i]);
+		freeUnparsingJSON(&pool->unparsers[i]);
+	}
+}
+
+/**
+ * Takes a free parser of the pool without locking, NULL if all are in use.
+ * It may be used by the calling thread until releaseParser().
+ */
+parser_s *acquireParser(pool_s *pool) {
+	int i;
+	for (i = 0; i < JSON_POOL_SIZE; i++) {
+		if (JSON_TRY_ACQUIRE(&pool->parserBusy[i])) {
+			return &pool->parsers[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Gives a parser back to the pool. Its tokens stay allocated for the next
+ * user, the next start...JSON() resets only the state of this parse.
+ */
+void releaseParser(pool_s *pool, parser_s *parser) {
+	if (parser->isParsing) {
+		endParsingJSON(parser);
+	}
+	JSON_RELEASE(&pool->parserBusy[parser - pool->parsers]);
+}
+
+unparser_s *acquireUnparser(pool_s *pool) {
+	int i;
+	for (i = 0; i < JSON_POOL_SIZE; i++) {
+		if (JSON_TRY_ACQUIRE(&pool->unparserBusy[i])) {
+			return &pool->unparsers[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Gives an unparser back to the pool, keeping its buffer. An unparse still
+ * in progress is ended, settings made with setUnparsingFlush() and
+ * setUnparsingEscapeUnicode() are dropped.
+ */
+void releaseUnparser(pool_s *pool, unparser_s *unparser) {
+	if (unparser->isUnparsing) {
+		endUnparsingJSON(unparser);
+	}
+	unparser->stackpos = 0;
+	unparser->error = JSON_ERROR_OK;
+	unparser->bufp = unparser->buffer;
+	if (unparser->flush != NULL) {
+		unparser->flush = NULL;
+		unparser->flushContext = NULL;
+	}
+	unparser->escapeUnicode = 0;
+	JSON_RELEASE(&pool->unparserBusy[unparser - pool->unparsers]);
+}
+
+/**
+ * Prepares a batch for parseBatchJSON(). grow allocates the tokens and
+ * records of the slices and is called from the tasks concurrently. Without
+ * parallel the slices are tokenized one after the other.
+ */
+void initBatchJSON(batch_s *batch, djson_realloc_f grow, void *growContext,
+		djson_parallel_f parallel, void *parallelContext) {
+	int i;
+	for (i = 0; i < JSON_BATCH_TASKS; i++) {
+		batchtask_t *task = &batch->tasks[i];
+		initParsingJSON(&task->parser, NULL, 0, grow, growContext);
+		task->records = NULL;
+		task->numRecords = 0;
+		task->recordSize = 0;
+		task->firstRecord = 0;
+		task->json = NULL;
+		task->length = 0;
+		task->error = JSON_ERROR_OK;
+	}
+	batch->numTasks = 0;
+	batch->numRecords = 0;
+	batch->parallel = parallel;
+	batch->parallelContext = parallelContext;
+}
+
+/**
+ * Releases the tokens and records, parsers of getRecordParser() become invalid.
+ */
+void freeBatchJSON(batch_s *batch) {
+	int i;
+	for (i = 0; i < JSON_BATCH_TASKS; i++) {
+		batchtask_t *task = &batch->tasks[i];
+		if (task->records != NULL) {
+			task->parser.growTokens(task->parser.growContext, task->records,
+					task->recordSize * sizeof(batchrecord_t), 0);
+			task->records = NULL;
+		}
+		task->recordSize = 0;
+		task->numRecords = 0;
+		freeParsingJSON(&task->parser);
+	}
+	batch->numTasks = 0;
+	batch->numRecords = 0;
+}
+
+/*
+ * Makes room for one more record of a slice.
+ */
+static bool jsmne_batch_reserve(batchtask_t *task) {
+	size_t size = (task->recordSize > 0) ? task->recordSize * 2 : 256;
+	batchrecord_t *records;
+
+	if (task->numRecords < task->recordSize) {
+		return true;
+	}
+	if (task->parser.growTokens == NULL) {
+		return false;
+	}
+	records = task->parser.growTokens(task->parser.growContext, task->records,
+			task->recordSize * sizeof(batchrecord_t), size * sizeof(batchrecord_t));
+	if (records == NULL) {
+		return false;
+	}
+	task->records = records;
+	task->recordSize = size;
+	return true;
+}
+
+/*
+ * Task of parseBatchJSON(): splits a slice into lines and tokenizes them,
+ * appending the tokens of every line to the tokens of the slice. Trailing
+ * spaces, tabs and '\r' are no part of a line, blank lines are no records.
+ */
+static void jsmne_batch_task(void *arg, size_t index) {
+	batchtask_t *task = &((batch_s *) arg)->tasks[index];
+	parser_s *parser = &task->parser;
+	const char *js = task->json;
+	const char *end = task->json + task->length;
+	size_t used = 0;
+
+	task->numRecords = 0;
+	task->error = JSON_ERROR_OK;
+	parser->length = 0;
+	while (js < end) {
+		const char *eol = memchr(js, '\n', (size_t) (end - js));
+		size_t length;
+		batchrecord_t *record;
+		json_offset_t r;
+
+		if (eol == NULL) {
+			eol = end;
+		}
+		length = (size_t) (eol - js);
+		while (length > 0 && (js[length - 1] == '\r' || js[length - 1] == ' ' || js[length - 1] == '\t')) {
+			length--;
+		}
+		if (length == 0) {
+			js = eol + 1;
+			continue;
+		}
+		if (!jsmne_batch_reserve(task)) {
+			task->error = JSON_ERROR_NOMEM;
+			return;
+		}
+		record = &task->records[task->numRecords++];
+		record->json = js;
+		record->length = length;
+		record->firstToken = used;
+
+		jsmne_init(&parser->state);
+		if (length >= (size_t) JSON_OFFSET_MAX) {
+			r = JSON_ERROR_TOO_LARGE;
+		} else if (parser->tokens == NULL && !jsmne_grow_tokens(parser)) {
+			r = JSON_ERROR_NOMEM;
+		} else {
+			r = jsmne_parse(&parser->state, js, length, parser->tokens + used, parser->numTokens - used);
+			while (r == JSON_ERROR_NOMEM && jsmne_grow_tokens(parser)) {
+				r = jsmne_parse(&parser->state, js, length, parser->tokens + used, parser->numTokens - used);
+			}
+		}
+		record->numTokens = parser->state.toknext;
+		record->error = (r < 0) ? (int) r : (r == 0) ? JSON_ERROR_PART : JSON_ERROR_OK;
+		if (r == JSON_ERROR_NOMEM) {
+			task->error = JSON_ERROR_NOMEM;
+		}
+		used += record->numTokens;
+		js = eol + 1;
+	}
+	parser->length = used;
+}
+
+/**
+ * Tokenizes NDJSON, one JSON per line, which must stay unchanged while the
+ * records are used. The buffer is cut into slices of whole lines, which are
+ * tokenized by the parallel callback of the batch into tokens of their own.
+ * Tokens and records are kept for the next batch. Returns JSON_ERROR_NOMEM
+ * if not all records could be stored; errors of single records are
+ * returned by getRecordParser().
+ */
+int parseBatchJSON(batch_s *batch, const char *json, size_t length) {
+	const char *begin = json;
+	const char *end = json + length;
+	size_t tasks = length / JSON_BATCH_MIN + 1;
+	size_t i;
+	int error = JSON_ERROR_OK;
+
+	if (tasks > JSON_BATCH_TASKS) {
+		tasks = JSON_BATCH_TASKS;
+	}
+	for (i = 0; i < tasks; i++) {
+		batchtask_t *task = &batch->tasks[i];
+		const char *stop = end;
+		if (i + 1 < tasks) {
+			const char *cut = json + length / tasks * (i + 1);
+			const char *eol;
+			if (cut < begin) {
+				cut = begin;
+			}
+			eol = memchr(cut, '\n', (size_t) (end - cut));
+			stop = (eol != NULL) ? eol + 1 : end;
+		}
+		task->json = begin;
+		task->length = (size_t) (stop - begin);
+		begin = stop;
+	}
+	batch->numTasks = tasks;
+	if (batch->parallel != NULL && tasks > 1) {
+		batch->parallel(batch->parallelContext, tasks, jsmne_batch_task, batch);
+	} else {
+		for (i = 0; i < tasks; i++) {
+			jsmne_batch_task(batch, i);
+		}
+	}
+	batch->numRecords = 0;
+	for (i = 0; i < tasks; i++) {
+		batch->tasks[i].firstRecord = batch->numRecords;
+		batch->numRecords += batch->tasks[i].numRecords;
+		if (batch->tasks[i].error != JSON_ERROR_OK) {
+			error = batch->tasks[i].error;
+		}
+	}
+	return error;
+}
+
+/**
+ * Number of records of the last parseBatchJSON().
+ */
+size_t sizeOfRecords(batch_s *batch) {
+	return batch->numRecords;
+}
+
+/**
+ * Prepares parser to read the record at index, without copying its tokens.
+ * It may be used like a parser of startParsingJSONn() until the next batch
+ * is parsed, by any thread; freeParsingJSON() releases it and leaves the
+ * tokens to the batch. Returns the result of tokenizing the record, or
+ * JSON_ERROR_INVAL if there is no such record.
+ */
+int getRecordParser(batch_s *batch, size_t index, parser_s *parser) {
+	size_t low = 0, high = batch->numTasks;
+	batchtask_t *task;
+	batchrecord_t *record;
+
+	if (index >= batch->numRecords) {
+		return JSON_ERROR_INVAL;
+	}
+	/* Last slice which starts at or before index */
+	while (high - low > 1) {
+		size_t middle = (low + high) / 2;
+		if (batch->tasks[middle].firstRecord <= index) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+	task = &batch->tasks[low];
+	record = &task->records[index - task->firstRecord];
+	initParsingJSON(parser, task->parser.tokens + record->firstToken, record->numTokens, NULL, NULL);
+	parser->json = record->json;
+	parser->jsonLength = record->length;
+	parser->length = record->numTokens;
+	parser->error = record->error;
+	/* A finished parse, as if by startParsingJSONn() */
+	parser->state.toknext = record->numTokens;
+	parser->state.pos = record->length;
+	return record->error;
+}
+
+/*
+ * A slice of the root array in parseParallelJSON(). Phase 1 scans it
+ * without knowing whether it starts inside a string: a quote toggles the
+ * state, so the bracket depth is counted for both cases at once.
+ */
+typedef struct {
+	size_t begin;
+	size_t end;
+	bool endInString[2];				// state at the end, for a start outside / inside a string
+	json_offset_t depth[2];				// change of the depth, dito
+	bool inString;						// actual state at begin
+	json_offset_t startDepth;			// actual depth at begin
+	size_t comma;						// first comma between elements of the root array, or end
+} jsmne_chunk_t;
+
+// Elements of the root array, tokenized by one task.
+typedef struct {
+	size_t begin;
+	size_t end;
+	size_t firstToken;					// index of its first token in the parse
+	json_offset_t elements;
+	int error;
+} jsmne_range_t;
+
+typedef struct {
+	batch_s *batch;
+	parser_s *parser;
+	const char *js;
+	jsmne_chunk_t chunks[JSON_BATCH_TASKS];
+	jsmne_range_t ranges[JSON_BATCH_TASKS];
+} jsmne_split_t;
+
+/*
+ * Walks a chunk, counting the depth for a start outside and inside a
+ * string. Phase 1 walks it to the end; phase 2, which knows the state at
+ * begin, stops at the first comma between elements of the root array.
+ */
+static void jsmne_split_walk(const char *js, jsmne_chunk_t *chunk, bool cut) {
+	bool inString = false;
+	json_offset_t outside = 0, inside = 0;
+	size_t pos, escaped = chunk->begin;
+
+	for (pos = chunk->begin; pos < chunk->end; pos += 16) {
+		uint64_t mask = jsmne_structural_mask(js + pos, chunk->end - pos, cut);
+		while (mask != 0) {
+			size_t at = pos + jsmne_ctz(mask) / JSON_MASK_STEP;
+			mask &= mask - 1;
+			if (at < escaped) {
+				continue;
+			}
+			switch (js[at]) {
+				case '\\':
+					escaped = at + 2;
+					break;
+				case '\"':
+					inString = !inString;
+					break;
+				case '{': case '[':
+					if (inString) inside++; else outside++;
+					break;
+				case '}': case ']':
+					if (inString) inside--; else outside--;
+					break;
+				case ',':
+					if (inString == chunk->inString &&
+							chunk->startDepth + (chunk->inString ? inside : outside) == 1) {
+						chunk->comma = at;
+						return;
+					}
+					break;
+			}
+		}
+	}
+	chunk->endInString[0] = inString;
+	chunk->endInString[1] = !inString;
+	chunk->depth[0] = outside;
+	chunk->depth[1] = inside;
+}
+
+/*
+ * Phase 1: depth changes and string state at the end of a chunk.
+ */
+static void jsmne_split_scan(void *arg, size_t index) {
+	jsmne_split_t *split = arg;
+	jsmne_split_walk(split->js, &split->chunks[index], false);
+}
+
+/*
+ * Phase 2: the first comma of a chunk between elements of the root array.
+ */
+static void jsmne_split_cut(void *arg, size_t index) {
+	jsmne_split_t *split = arg;
+	split->chunks[index].comma = split->chunks[index].end;
+	jsmne_split_walk(split->js, &split->chunks[index], true);
+}
+
+/*
+ * Phase 3: tokenizes a range of elements like a list of root values.
+ */
+static void jsmne_split_parse(void *arg, size_t index) {
+	jsmne_split_t *split = arg;
+	jsmne_range_t *range = &split->ranges[index];
+	parser_s *parser = &split->batch->tasks[index].parser;
+	json_offset_t r = JSON_ERROR_NOMEM;
+
+	jsmne_init(&parser->state);
+	parser->state.pos = range->begin;
+	/* Inside of the root array */
+	parser->state.outer = 1;
+	if (parser->tokens != NULL || jsmne_grow_tokens(parser)) {
+		r = jsmne_parse(&parser->state, split->js, range->end, parser->tokens, parser->numTokens);
+		while (r == JSON_ERROR_NOMEM && jsmne_grow_tokens(parser)) {
+			r = jsmne_parse(&parser->state, split->js, range->end, parser->tokens, parser->numTokens);
+		}
+	}
+	parser->length = parser->state.toknext;
+	range->error = (r < 0) ? (int) r : JSON_ERROR_OK;
+	/* No element between two commas */
+	if (parser->length == 0) {
+		range->error = JSON_ERROR_INVAL;
+	}
+}
+
+/*
+ * Phase 4: copies the tokens of a range into the parse, under the root array.
+ */
+static void jsmne_split_stitch(void *arg, size_t index) {
+	jsmne_split_t *split = arg;
+	jsmne_range_t *range = &split->ranges[index];
+	parser_s *parser = &split->batch->tasks[index].parser;
+	json_offset_t base = (json_offset_t) range->firstToken;
+	token_s *tokens = split->parser->tokens + base;
+	size_t i;
+
+	range->elements = 0;
+	for (i = 0; i < parser->length; i++) {
+		token_s *token = &tokens[i];
+		json_offset_t parent;
+		*token = parser->tokens[i];
+		parent = TOKEN_PARENT(token);
+		if (parent < 0) {
+			range->elements++;
+		}
+		TOKEN_SET_PARENT(token, (parent < 0) ? 0 : parent + base);
+		if (TOKEN_TYPE(token) == JSON_OBJECT || TOKEN_TYPE(token) == JSON_ARRAY) {
+			TOKEN_CLOSE(token, TOKEN_SKIP(token) + base);
+		}
+	}
+}
+
+/**
+ * Parses a JSON whose root is an array with threads, to the same tokens as
+ * startParsingJSONn(). Chunks of the array are scanned in parallel for the
+ * commas between its elements, then the elements between these commas are
+ * tokenized in parallel and their tokens are joined. The batch provides
+ * the parallel callback and the tokens of the tasks, its records are gone
+ * afterwards. Other JSON, small ones and invalid ones are parsed in one go.
+ */
+int parseParallelJSON(batch_s *batch, parser_s *parser, const char *js, size_t len) {
+	jsmne_split_t split;
+	size_t open, close, count, ranges = 0, total = 1, i;
+	bool inString = false;
+	json_offset_t depth = 1;
+	token_s *root;
+
+	jsmne_begin(parser);
+	batch->numTasks = 0;
+	batch->numRecords = 0;
+	count = len / JSON_BATCH_MIN;
+	if (count > JSON_BATCH_TASKS) {
+		count = JSON_BATCH_TASKS;
+	}
+	if (batch->parallel == NULL || count < 2 || len >= (size_t) JSON_OFFSET_MAX ||
+			batch->tasks[0].parser.growTokens == NULL) {
+		return jsmne_continue(parser, js, len);
+	}
+	open = 0;
+	while (open < len && (js[open] == ' ' || js[open] == '\t' || js[open] == '\n' || js[open] == '\r')) {
+		open++;
+	}
+	close = len;
+	while (close > open && (js[close - 1] == ' ' || js[close - 1] == '\t' ||
+			js[close - 1] == '\n' || js[close - 1] == '\r')) {
+		close--;
+	}
+	if (open >= len || js[open] != '[' || close - open < 2 || js[close - 1] != ']') {
+		return jsmne_continue(parser, js, len);
+	}
+	close--;
+	split.batch = batch;
+	split.parser = parser;
+	split.js = js;
+
+	/* Phase 1: chunks of the array which do not start behind a backslash */
+	for (i = 0; i < count; i++) {
+		jsmne_chunk_t *chunk = &split.chunks[i];
+		chunk->begin = (i == 0) ? open + 1 : split.chunks[i - 1].end;
+		chunk->end = (i + 1 < count) ? open + 1 + (close - open - 1) / count * (i + 1) : close;
+		if (chunk->end < chunk->begin) {
+			chunk->end = chunk->begin;
+		}
+		while (chunk->end < close && js[chunk->end - 1] == '\\') {
+			chunk->end++;
+		}
+	}
+	batch->parallel(batch->parallelContext, count, jsmne_split_scan, &split);
+	for (i = 0; i < count; i++) {
+		jsmne_chunk_t *chunk = &split.chunks[i];
+		chunk->inString = inString;
+		chunk->startDepth = depth;
+		depth += chunk->depth[inString];
+		inString = chunk->endInString[inString];
+	}
+	if (inString || depth != 1) {
+		return jsmne_continue(parser, js, len);
+	}
+
+	/* Phase 2: a range of elements ends at the first comma of a chunk */
+	batch->parallel(batch->parallelContext, count, jsmne_split_cut, &split);
+	split.ranges[0].begin = open + 1;
+	for (i = 1; i < count; i++) {
+		if (split.chunks[i].comma < split.chunks[i].end) {
+			split.ranges[ranges++].end = split.chunks[i].comma;
+			split.ranges[ranges].begin = split.chunks[i].comma + 1;
+		}
+	}
+	split.ranges[ranges++].end = close;
+	if (ranges < 2) {
+		return jsmne_continue(parser, js, len);
+	}
+
+	/* Phase 3: tokens of the ranges, each behind the one before */
+	batch->parallel(batch->parallelContext, ranges, jsmne_split_parse, &split);
+	for (i = 0; i < ranges; i++) {
+		if (split.ranges[i].error != JSON_ERROR_OK) {
+			return jsmne_continue(parser, js, len);
+		}
+		split.ranges[i].firstToken = total;
+		total += batch->tasks[i].parser.length;
+	}
+	#ifdef JSON_COMPACT_TOKENS
+	if (total >= TOKEN_PARENT_MASK - 1) {
+		return jsmne_continue(parser, js, len);
+	}
+	#endif
+	while (parser->numTokens < total) {
+		if (total >= (size_t) JSON_OFFSET_MAX || !jsmne_grow_tokens(parser)) {
+			return jsmne_continue(parser, js, len);
+		}
+	}
+
+	/* Phase 4: the tokens joined under the root array */
+	batch->parallel(batch->parallelContext, ranges, jsmne_split_stitch, &split);
+	root = &parser->tokens[0];
+	TOKEN_RESET(root);
+	TOKEN_SET_TYPE(root, JSON_ARRAY);
+	root->start = (json_offset_t) open;
+	root->end = (json_offset_t) close + 1;
+	for (i = 0; i < ranges; i++) {
+		TOKEN_SIZE(root) += split.ranges[i].elements;
+	}
+	TOKEN_CLOSE(root, (json_offset_t) total);
+
+	parser->json = js;
+	parser->jsonLength = len;
+	parser->state.pos = len;
+	parser->state.toknext = total;
+	parser->length = total;
+	parser->error = JSON_ERROR_OK;
+	return parser->error;
+}
@@ -0,0 +1,99 @@
+/*
+ * Parse time per element of flat objects and of arrays of objects from 1k
+ * to 128k elements. The parser works with a stack of the open containers,
+ * so the time per element must not grow with the number of elements; a
+ * scan for the enclosing container at every ',' made it quadratic.
+ *
+ * Usage: bench-parsing [repeats], fails if the per-element time of the
+ * largest document is more than JSON_BENCH_SLACK times that of the smallest.
+ * Built and run by ctest with cmake -DJSON_BUILD_BENCHMARKS=ON only.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aiko-json.h"
+#include "test.h"
+
+#ifndef JSON_BENCH_SLACK
+	#define JSON_BENCH_SLACK (4.0)
+#endif
+
+#define BENCH_MIN (1024)
+#define BENCH_MAX (131072)
+
+static double seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static char *make_document(int kind, size_t count, size_t *length) {
+	char *js = malloc(count * 48 + 16);
+	char *p = js;
+	size_t i;
+
+	*p++ = (kind == 0) ? '{' : '[';
+	for (i = 0; i < count; i++) {
+		if (i > 0) {
+			*p++ = ',';
+		}
+		if (kind == 0) {
+			p += sprintf(p, "\"key%lu\":%lu", (unsigned long) i, (unsigned long) i);
+		} else {
+			p += sprintf(p, "{\"id\":%lu,\"name\":\"n\",\"ok\":true}", (unsigned long) i);
+		}
+	}
+	*p++ = (kind == 0) ? '}' : ']';
+	*length = p - js;
+	return js;
+}
+
+/* Best time of repeats parses, per element in nanoseconds */
+static double time_parse(parser_s *parser, const char *js, size_t length, size_t count, int repeats) {
+	double best = 1e30;
+	int r;
+
+	for (r = 0; r < repeats; r++) {
+		/* Enough parses for a measurable time */
+		size_t rounds = BENCH_MAX / count, i;
+		double start = seconds(), elapsed;
+		for (i = 0; i < rounds; i++) {
+			CHECK(startParsingJSONn(parser, js, length) == JSON_ERROR_OK);
+			endParsingJSON(parser);
+		}
+		elapsed = (seconds() - start) / rounds;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+	return best * 1e9 / count;
+}
+
+int main(int argc, char **argv) {
+	static const char *kinds[] = { "flat object", "array of objects" };
+	int repeats = (argc > 1) ? atoi(argv[1]) : 5;
+	parser_s parser;
+	int kind;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	for (kind = 0; kind < 2; kind++) {
+		double smallest = 0, largest = 0;
+		size_t count;
+		for (count = BENCH_MIN; count <= BENCH_MAX; count *= 2) {
+			size_t length;
+			char *js = make_document(kind, count, &length);
+			double ns = time_parse(&parser, js, length, count, repeats);
+			printf("%-16s %7lu elements %9lu bytes %8.1f ns/element\n", kinds[kind],
+					(unsigned long) count, (unsigned long) length, ns);
+			if (count == BENCH_MIN) {
+				smallest = ns;
+			}
+			largest = ns;
+			free(js);
+		}
+		CHECK(largest <= smallest * JSON_BENCH_SLACK);
+	}
+	freeParsingJSON(&parser);
+	return TEST_RESULT;
+}
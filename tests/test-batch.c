@@ -0,0 +1,121 @@
+/*
+ * NDJSON batches: one record per line, blank lines are none, and every
+ * record parser works like a parser of startParsingJSONn().
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "aiko-json.h"
+#include "test.h"
+
+static batch_s batch;
+
+static void serial(void *ctx, size_t count, djson_task_f task, void *arg) {
+	size_t i;
+	(void) ctx;
+	for (i = 0; i < count; i++) {
+		task(arg, i);
+	}
+}
+
+/* Value of key in record as a view, empty if there is none */
+static strview_s record_value(size_t index, const char *key) {
+	strview_s none = { NULL, 0 };
+	parser_s parser;
+	strview_s view;
+
+	if (getRecordParser(&batch, index, &parser) != JSON_ERROR_OK) {
+		return none;
+	}
+	view = tokenAtToView(&parser, findKey(&parser, 0, key));
+	freeParsingJSON(&parser);
+	return view;
+}
+
+static bool is_value(strview_s view, const char *value) {
+	return view.length == strlen(value) && memcmp(view.string, value, view.length) == 0;
+}
+
+static void test_lines(void) {
+	static const char lf[] = "{\"id\":1}\n{\"id\":2}\n{\"id\":3}";
+	static const char crlf[] = "{\"id\":1}\r\n{\"id\":2} \t\r\n";
+	static const char blank[] = "1\n   \n\t\r\n\n2\n";
+	static const char bad[] = "{\"id\":1}\n{\"id\":\n{\"id\":3]\n{\"id\":4}\n";
+	parser_s parser;
+
+	CHECK(parseBatchJSON(&batch, lf, strlen(lf)) == JSON_ERROR_OK);
+	CHECK(sizeOfRecords(&batch) == 3);
+	CHECK(is_value(record_value(0, "id"), "1") && is_value(record_value(2, "id"), "3"));
+	CHECK(getRecordParser(&batch, 3, &parser) == JSON_ERROR_INVAL);
+
+	CHECK(parseBatchJSON(&batch, crlf, strlen(crlf)) == JSON_ERROR_OK);
+	CHECK(sizeOfRecords(&batch) == 2);
+	CHECK(getRecordParser(&batch, 1, &parser) == JSON_ERROR_OK);
+	CHECK(tokenAtToView(&parser, 0).length == 8);
+	freeParsingJSON(&parser);
+
+	CHECK(parseBatchJSON(&batch, blank, strlen(blank)) == JSON_ERROR_OK);
+	CHECK(sizeOfRecords(&batch) == 2);
+	CHECK(getRecordParser(&batch, 0, &parser) == JSON_ERROR_OK);
+	freeParsingJSON(&parser);
+	CHECK(getRecordParser(&batch, 1, &parser) == JSON_ERROR_OK);
+	CHECK(is_value(tokenAtToView(&parser, 0), "2"));
+	freeParsingJSON(&parser);
+
+	/* Bad records fail alone */
+	CHECK(parseBatchJSON(&batch, bad, strlen(bad)) == JSON_ERROR_OK);
+	CHECK(sizeOfRecords(&batch) == 4);
+	CHECK(getRecordParser(&batch, 1, &parser) == JSON_ERROR_PART);
+	freeParsingJSON(&parser);
+	CHECK(getRecordParser(&batch, 2, &parser) == JSON_ERROR_INVAL);
+	freeParsingJSON(&parser);
+	CHECK(is_value(record_value(0, "id"), "1") && is_value(record_value(3, "id"), "4"));
+}
+
+/* A record parser builds a DOM and finds keys like startParsingJSONn() */
+static void test_record_parser(void) {
+	static const char js[] = "{\"level\":\"info\",\"n\":[1,2]}\n{\"level\":\"error\",\"n\":{\"a\":true}}\n{\"x\":\n";
+	arena_s arena;
+	node_s *root;
+	parser_s parser;
+
+	CHECK(parseBatchJSON(&batch, js, strlen(js)) == JSON_ERROR_OK);
+	CHECK(sizeOfRecords(&batch) == 3);
+	initArenaJSON(&arena, NULL, 0, reallocJSON, NULL);
+	CHECK(getRecordParser(&batch, 1, &parser) == JSON_ERROR_OK);
+	CHECK(is_value(tokenAtToView(&parser, findKey(&parser, findKey(&parser, 0, "n"), "a")), "true"));
+	CHECK(buildDOM(&parser, &arena, &root) == JSON_ERROR_OK);
+	CHECK(root->count == 2 && getMember(root, "level") != NULL &&
+			strcmp(getMember(root, "level")->value.string, "error") == 0);
+	freeParsingJSON(&parser);
+	CHECK(getRecordParser(&batch, 2, &parser) == JSON_ERROR_PART);
+	CHECK(buildDOM(&parser, &arena, &root) == JSON_ERROR_PART);
+	freeParsingJSON(&parser);
+	freeArenaJSON(&arena);
+}
+
+/* Several slices, each tokenized by its own task */
+static void test_slices(void) {
+	size_t count = 3 * JSON_BATCH_MIN / 16, i;
+	char *js = malloc(count * 24);
+	char *p = js;
+
+	for (i = 0; i < count; i++) {
+		p += sprintf(p, "{\"id\":%lu}\n", (unsigned long) i);
+	}
+	CHECK(parseBatchJSON(&batch, js, (size_t) (p - js)) == JSON_ERROR_OK);
+	CHECK(sizeOfRecords(&batch) == count);
+	CHECK(is_value(record_value(0, "id"), "0"));
+	sprintf(js + (p - js), "%lu", (unsigned long) count - 1);
+	CHECK(is_value(record_value(count - 1, "id"), js + (p - js)));
+	free(js);
+}
+
+int main(void) {
+	initBatchJSON(&batch, reallocJSON, NULL, serial, NULL);
+	test_lines();
+	test_record_parser();
+	test_slices();
+	freeBatchJSON(&batch);
+	return TEST_RESULT;
+}
@@ -0,0 +1,74 @@
+/*
+ * buildDOM() gives the values of the tokens, and fails for tokens which do
+ * not form a tree of keys and values.
+ */
+#include <string.h>
+
+#include "aiko-json.h"
+#include "test.h"
+
+static int build(parser_s *parser, arena_s *arena, const char *js, node_s **root) {
+	int r = startParsingJSONn(parser, js, strlen(js));
+	if (r == JSON_ERROR_OK) {
+		r = buildDOM(parser, arena, root);
+	}
+	endParsingJSON(parser);
+	return r;
+}
+
+static void test_values(parser_s *parser, arena_s *arena) {
+	static const char *js = "{\"s\":\"a\\u00e9\\n\",\"i\":-12,\"d\":2.5,\"b\":true,\"n\":null,"
+			"\"a\":[1,[],{}],\"o\":{\"k\":\"v\"}}";
+	const node_s *a;
+	node_s *root;
+
+	CHECK(build(parser, arena, js, &root) == JSON_ERROR_OK);
+	CHECK(root->type == JSON_NODE_OBJECT && root->count == 7);
+	CHECK(getMember(root, "s") != NULL && getMember(root, "s")->count == 4 &&
+			strcmp(getMember(root, "s")->value.string, "a\xc3\xa9\n") == 0);
+	CHECK(getMember(root, "i") != NULL && getMember(root, "i")->type == JSON_NODE_INTEGER &&
+			getMember(root, "i")->value.integer == -12);
+	CHECK(getMember(root, "d") != NULL && getMember(root, "d")->type == JSON_NODE_NUMBER &&
+			getMember(root, "d")->value.number == 2.5);
+	CHECK(getMember(root, "b") != NULL && getMember(root, "b")->value.boolean);
+	CHECK(getMember(root, "n") != NULL && getMember(root, "n")->type == JSON_NODE_NULL);
+	a = getMember(root, "a");
+	CHECK(a != NULL && a->type == JSON_NODE_ARRAY && a->count == 3);
+	CHECK(a != NULL && a->value.children[1].type == JSON_NODE_ARRAY && a->value.children[1].count == 0);
+	CHECK(getMember(getMember(root, "o"), "k") != NULL &&
+			strcmp(getMember(getMember(root, "o"), "k")->value.string, "v") == 0);
+	CHECK(getMember(root, "missing") == NULL);
+}
+
+/* Either the tokenizer or buildDOM() rejects them */
+static void test_malformed(parser_s *parser, arena_s *arena) {
+	static const char *invalid[] = {
+		"{\"a\"}", "{\"a\",\"b\":1}", "{\"a\":1,\"b\"}", "[\"a\":1]", "{1:2}", "{\"a\":{\"b\"}}",
+		"{\"a\":1e400}"
+	};
+	node_s *root;
+	size_t i;
+
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		int r = build(parser, arena, invalid[i], &root);
+		CHECK(r != JSON_ERROR_OK);
+		if (r == JSON_ERROR_OK) {
+			fprintf(stderr, "accepted %s\n", invalid[i]);
+		}
+		resetArenaJSON(arena);
+	}
+}
+
+int main(void) {
+	parser_s parser;
+	arena_s arena;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	initArenaJSON(&arena, NULL, 0, reallocJSON, NULL);
+	test_values(&parser, &arena);
+	resetArenaJSON(&arena);
+	test_malformed(&parser, &arena);
+	freeArenaJSON(&arena);
+	freeParsingJSON(&parser);
+	return TEST_RESULT;
+}
@@ -0,0 +1,188 @@
+/*
+ * Numbers written by the unparser read back to the same value, and
+ * tokenToDouble() agrees with strtod() within the range of double.
+ */
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aiko-json.h"
+#include "test.h"
+
+#define RANDOM_DOUBLES (100000)
+
+static uint64_t state = 88172645463325252ULL;
+
+static uint64_t xorshift(void) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static const double edges[] = {
+	0.0, -0.0, 1.0, -1.0, 0.1, 0.2, 0.3, 1.0 / 3, 2.0 / 3, 5e-324, 1e-323,
+	2.2250738585072009e-308, DBL_MIN, DBL_MAX, -DBL_MAX, DBL_EPSILON,
+	1e21, 1e22, 1e23, 9007199254740991.0, 9007199254740993.0, 123456789012345678.0,
+	1e-6, 1e-7, 0.000001234, 1234e30, 1.7976931348623157e308, 4.9406564584124654e-324,
+	299792458.0, 6.02214076e23, 1.602176634e-19
+};
+
+static const int64_t integers[] = {
+	0, 1, -1, 9, 10, 99, 100, 4294967295LL, -4294967296LL, 999999999999999999LL,
+	INT64_MAX, INT64_MIN, INT64_MIN + 1
+};
+
+static double next_double(size_t i) {
+	uint64_t bits;
+	double value;
+
+	if (i < sizeof(edges) / sizeof(edges[0])) {
+		return edges[i];
+	}
+	/* Random bit patterns cover all exponents, short decimals common values */
+	do {
+		bits = xorshift();
+		memcpy(&value, &bits, sizeof(value));
+	} while (value != value || value - value != 0);
+	if (i % 3 == 0) {
+		value = (double) (int64_t) (xorshift() % 2000001 - 1000000) / 1000;
+	}
+	return value;
+}
+
+static void test_doubles(void) {
+	unparser_s unparser;
+	parser_s parser;
+	double *values = malloc(RANDOM_DOUBLES * sizeof(double));
+	size_t i;
+
+	for (i = 0; i < RANDOM_DOUBLES; i++) {
+		values[i] = next_double(i);
+	}
+	initUnparsingJSON(&unparser, NULL, 0, reallocJSON, NULL);
+	startUnparsingJSON(&unparser, JSON_ARRAY, JSON_COMPACT);
+	for (i = 0; i < RANDOM_DOUBLES; i++) {
+		addDoubleToArray(&unparser, values[i]);
+	}
+	CHECK(endJSON(&unparser) == JSON_ERROR_OK);
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONn(&parser, getJSON(&unparser), getJSONSize(&unparser)) == JSON_ERROR_OK);
+	CHECK(sizeOfTokens(&parser) == RANDOM_DOUBLES + 1);
+	nextToken(&parser);
+	for (i = 0; i < RANDOM_DOUBLES && hasCurrentToken(&parser); i++, nextToken(&parser)) {
+		strview_s view = tokenToView(&parser);
+		char text[64];
+		double value;
+
+		CHECK(tokenToDouble(&parser, &value) == JSON_ERROR_OK);
+		CHECK(memcmp(&value, &values[i], sizeof(value)) == 0 || (value == 0 && values[i] == 0));
+		CHECK(view.length < sizeof(text));
+		memcpy(text, view.string, view.length);
+		text[view.length] = '\0';
+		CHECK(value == strtod(text, NULL));
+		if (memcmp(&value, &values[i], sizeof(value)) != 0 && value != values[i]) {
+			fprintf(stderr, "%.17g written as %s\n", values[i], text);
+		}
+	}
+	endParsingJSON(&parser);
+	freeParsingJSON(&parser);
+	freeUnparsingJSON(&unparser);
+	free(values);
+}
+
+static void test_integers(void) {
+	unparser_s unparser;
+	parser_s parser;
+	size_t count = sizeof(integers) / sizeof(integers[0]);
+	size_t i;
+
+	initUnparsingJSON(&unparser, NULL, 0, reallocJSON, NULL);
+	startUnparsingJSON(&unparser, JSON_ARRAY, JSON_COMPACT);
+	for (i = 0; i < count; i++) {
+		addInt64ToArray(&unparser, integers[i]);
+	}
+	CHECK(endJSON(&unparser) == JSON_ERROR_OK);
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONn(&parser, getJSON(&unparser), getJSONSize(&unparser)) == JSON_ERROR_OK);
+	nextToken(&parser);
+	for (i = 0; i < count && hasCurrentToken(&parser); i++, nextToken(&parser)) {
+		int64_t value;
+		CHECK(tokenToInt64(&parser, &value) == JSON_ERROR_OK);
+		CHECK(value == integers[i]);
+	}
+	CHECK(i == count);
+	endParsingJSON(&parser);
+	freeParsingJSON(&parser);
+	freeUnparsingJSON(&unparser);
+}
+
+/* Overflow is an error, underflow gives zero */
+static void test_range(void) {
+	static const char *js = "[1e400, -1e400, 1.8e308, 1.7976931348623157e308, 1e-400]";
+	parser_s parser;
+	double value;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONn(&parser, js, strlen(js)) == JSON_ERROR_OK);
+	nextToken(&parser);
+	CHECK(tokenToDouble(&parser, &value) == JSON_ERROR_INVAL);
+	nextToken(&parser);
+	CHECK(tokenToDouble(&parser, &value) == JSON_ERROR_INVAL);
+	nextToken(&parser);
+	CHECK(tokenToDouble(&parser, &value) == JSON_ERROR_INVAL);
+	nextToken(&parser);
+	CHECK(tokenToDouble(&parser, &value) == JSON_ERROR_OK && value == DBL_MAX);
+	nextToken(&parser);
+	CHECK(tokenToDouble(&parser, &value) == JSON_ERROR_OK && value == 0);
+	endParsingJSON(&parser);
+	freeParsingJSON(&parser);
+}
+
+/* A number as the whole document, parsed without a growth callback */
+static double long_number(parser_s *parser, const char *js) {
+	double value = -1;
+
+	CHECK(startParsingJSONn(parser, js, strlen(js)) == JSON_ERROR_OK);
+	CHECK(tokenToDouble(parser, &value) == JSON_ERROR_OK);
+	endParsingJSON(parser);
+	return value;
+}
+
+/* Numbers of any length need no memory, digits far behind only round */
+static void test_long(void) {
+	static const char halfway[] = "1.00000000000000011102230246251565404236316680908203125";
+	token_s tokens[4];
+	parser_s parser;
+	char *js = malloc(4096);
+
+	initParsingJSON(&parser, tokens, sizeof(tokens) / sizeof(tokens[0]), NULL, NULL);
+	/* Exactly halfway between 1 and the next double rounds to even, a bit above it up */
+	sprintf(js, "%s%01000d", halfway, 0);
+	CHECK(long_number(&parser, js) == 1);
+	sprintf(js, "%s%01000d1", halfway, 0);
+	CHECK(long_number(&parser, js) == 1 + DBL_EPSILON);
+	memset(js, '7', 1500);
+	strcpy(js + 1500, "e-1400");
+	CHECK(long_number(&parser, js) == strtod(js, NULL));
+	sprintf(js, "-0.%0300d123", 0);
+	CHECK(long_number(&parser, js) == -1.23e-301);
+	sprintf(js, "123%0900de-900", 0);
+	CHECK(long_number(&parser, js) == 123);
+	sprintf(js, "0.%01000de999999999999999999999", 0);
+	CHECK(long_number(&parser, js) == 0);
+	freeParsingJSON(&parser);
+	free(js);
+}
+
+int main(void) {
+	test_doubles();
+	test_range();
+	test_long();
+	test_integers();
+	return TEST_RESULT;
+}
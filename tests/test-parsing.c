@@ -0,0 +1,534 @@
+/*
+ * Parsing in chunks gives the tokens of parsing at once, and so do lookups
+ * into a lazy parse in any order and the parallel parse. isValidJSON()
+ * rejects raw control characters in strings.
+ */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aiko-json.h"
+#include "test.h"
+
+static const char *documents[] = {
+	"{\"a\":1,\"b\":[true,false,null],\"c\":{\"d\":\"e\"}}",
+	"[1, -2.5e3, \"x\\\"y\\\\z\\u00e9\", {}, [], [[[]]], {\"k\": {\"l\": [0]}}]",
+	"  {\n\t\"key\" : \"value with spaces\" ,\r\n \"n\" : 123456789012 }  ",
+	"{\"\xc3\xa9t\xc3\xa9\":\"\xe2\x82\xac\",\"escaped\\n\":\"\\ud83d\\ude00\"}",
+	"[\"\",\"\\\\\",\"\\\"\",{\"\":\"\"}]",
+	"[0,1,22,333,4444,55555,666666,7777777,-0,1e-7,1E+2]",
+};
+
+/* Same tokens as parsing the whole JSON at once */
+static void check_tokens(parser_s *parser, parser_s *whole) {
+	size_t i;
+
+	CHECK(sizeOfTokens(parser) == sizeOfTokens(whole));
+	for (i = 0; i < sizeOfTokens(parser) && i < sizeOfTokens(whole); i++) {
+		strview_s a = tokenAtToView(parser, i);
+		strview_s b = tokenAtToView(whole, i);
+		CHECK(tokenAtType(parser, i) == tokenAtType(whole, i));
+		CHECK(tokenAtSize(parser, i) == tokenAtSize(whole, i));
+		CHECK(tokenAtParent(parser, i) == tokenAtParent(whole, i));
+		CHECK(a.length == b.length && memcmp(a.string, b.string, a.length) == 0);
+	}
+}
+
+/* Length up to the end of the root, a shorter prefix is JSON_ERROR_PART */
+static size_t complete_length(const char *js) {
+	size_t len = strlen(js);
+	while (len > 0 && strchr(" \t\r\n", js[len - 1]) != NULL) {
+		len--;
+	}
+	return len;
+}
+
+static void test_feed(const char *js) {
+	size_t len = strlen(js);
+	size_t complete = complete_length(js);
+	parser_s whole, parser;
+	size_t split, i;
+
+	initParsingJSON(&whole, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONn(&whole, js, len) == JSON_ERROR_OK);
+
+	/* Two chunks, split at every byte */
+	for (split = 1; split < len; split++) {
+		initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+		CHECK(feedParsingJSON(&parser, js, split) == ((split < complete) ? JSON_ERROR_PART : JSON_ERROR_OK));
+		CHECK(feedParsingJSON(&parser, js, len) == JSON_ERROR_OK);
+		check_tokens(&parser, &whole);
+		endParsingJSON(&parser);
+		freeParsingJSON(&parser);
+	}
+
+	/* One byte at a time, from a buffer which is moved every time */
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	for (i = 1; i <= len; i++) {
+		char *copy = malloc(i);
+		int r;
+		memcpy(copy, js, i);
+		r = feedParsingJSON(&parser, copy, i);
+		CHECK(r == ((i < complete) ? JSON_ERROR_PART : JSON_ERROR_OK));
+		if (i == len) {
+			check_tokens(&parser, &whole);
+		}
+		free(copy);
+	}
+	endParsingJSON(&parser);
+	freeParsingJSON(&parser);
+
+	endParsingJSON(&whole);
+	freeParsingJSON(&whole);
+}
+
+static const char *nested = "{\"a\":{\"x\":4,\"y\":[5,{\"z\":6}]},\"b\":[7,[8]],\"c\":{\"d\":9}}";
+static const char *queries[] = { "/c/d", "/a/x", "/b/1/0", "/a/y/1/z", "/b/0", "/a", "/b/1" };
+#define QUERIES (sizeof(queries) / sizeof(queries[0]))
+
+static bool same_view(strview_s a, strview_s b) {
+	return a.length > 0 && a.length == b.length && memcmp(a.string, b.string, a.length) == 0;
+}
+
+/* Objects and arrays the lazy parse skipped are tokenized when a lookup goes into them */
+static void test_lazy(void) {
+	parser_s whole, parser;
+	arena_s arena;
+	node_s *root;
+	const node_s *x;
+	path_s path;
+	size_t first, n, i;
+
+	initParsingJSON(&whole, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONn(&whole, nested, strlen(nested)) == JSON_ERROR_OK);
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+
+	/* Every query first, after skipping everything but "c" */
+	for (first = 0; first < QUERIES; first++) {
+		CHECK(startParsingJSONLazy(&parser, nested, strlen(nested)) == JSON_ERROR_OK);
+		CHECK(findKey(&parser, 0, "c") > 0);
+		for (n = 0; n < QUERIES; n++) {
+			CHECK(compilePath(&path, queries[(first + n) % QUERIES]) == JSON_ERROR_OK);
+			CHECK(same_view(tokenAtToView(&parser, evalPath(&parser, &path)), tokenAtToView(&whole, evalPath(&whole, &path))));
+		}
+		check_tokens(&parser, &whole);
+		endParsingJSON(&parser);
+	}
+
+	CHECK(startParsingJSONLazy(&parser, nested, strlen(nested)) == JSON_ERROR_OK);
+	CHECK(findKey(&parser, 0, "b") > 0);
+	CHECK(same_view(tokenAtToView(&parser, findKey(&parser, findKey(&parser, 0, "a"), "x")), tokenAtToView(&whole, 4)));
+	CHECK(tokenAtSize(&parser, findKey(&parser, 0, "b")) == 2);
+	endParsingJSON(&parser);
+
+	/* The cursor goes into skipped ones too */
+	CHECK(startParsingJSONLazy(&parser, nested, strlen(nested)) == JSON_ERROR_OK);
+	CHECK(findKey(&parser, 0, "c") > 0);
+	for (i = 0; hasCurrentToken(&parser); i++, nextToken(&parser)) {
+		CHECK(same_view(tokenToView(&parser), tokenAtToView(&whole, i)));
+	}
+	CHECK(i == sizeOfTokens(&whole));
+	endParsingJSON(&parser);
+
+	CHECK(startParsingJSONLazy(&parser, nested, strlen(nested)) == JSON_ERROR_OK);
+	CHECK(findKey(&parser, 0, "c") > 0);
+	initArenaJSON(&arena, NULL, 0, reallocJSON, NULL);
+	CHECK(buildDOM(&parser, &arena, &root) == JSON_ERROR_OK);
+	x = getMember(getMember(root, "a"), "x");
+	CHECK(root->count == 3 && x != NULL && x->type == JSON_NODE_INTEGER && x->value.integer == 4);
+	freeArenaJSON(&arena);
+	endParsingJSON(&parser);
+
+	freeParsingJSON(&parser);
+	endParsingJSON(&whole);
+	freeParsingJSON(&whole);
+}
+
+/* A number or literal as root may go on in the next chunk until a byte follows it */
+static void test_feed_primitive(void) {
+	static const char *roots[] = { "35015", "-1.5e3", "true", "null" };
+	char js[16];
+	parser_s parser;
+	size_t i, split;
+
+	for (i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+		size_t len = strlen(roots[i]);
+		memcpy(js, roots[i], len);
+		js[len] = '\n';
+		for (split = 1; split <= len; split++) {
+			strview_s view;
+			initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+			CHECK(feedParsingJSON(&parser, js, split) == JSON_ERROR_PART);
+			CHECK(feedParsingJSON(&parser, js, len + 1) == JSON_ERROR_OK);
+			view = tokenAtToView(&parser, 0);
+			CHECK(sizeOfTokens(&parser) == 1 && view.length == len && memcmp(view.string, js, len) == 0);
+			endParsingJSON(&parser);
+			freeParsingJSON(&parser);
+		}
+	}
+}
+
+static void serial(void *ctx, size_t count, djson_task_f task, void *arg) {
+	size_t i;
+	(void) ctx;
+	for (i = 0; i < count; i++) {
+		task(arg, i);
+	}
+}
+
+/* A large root array with one element nested depth deep */
+static char *deep_array(int depth, size_t *length) {
+	size_t count = 4 * JSON_BATCH_MIN / 8, i;
+	char *js = malloc(count * 8 + 2 * depth + 16);
+	char *p = js;
+	int d;
+
+	*p++ = '[';
+	for (i = 0; i < count; i++) {
+		p += sprintf(p, "%s%lu", (i > 0) ? "," : "", (unsigned long) i % 1000000);
+		if (i == count / 2) {
+			*p++ = ',';
+			for (d = 0; d < depth; d++) *p++ = '[';
+			for (d = 0; d < depth; d++) *p++ = ']';
+		}
+	}
+	*p++ = ']';
+	*length = p - js;
+	return js;
+}
+
+/* Ranges of the parallel parse are nested in the root array */
+static void test_parallel_depth(void) {
+	static batch_s batch;
+	parser_s whole, parser;
+	int depth;
+
+	initBatchJSON(&batch, reallocJSON, NULL, serial, NULL);
+	initParsingJSON(&whole, NULL, 0, reallocJSON, NULL);
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	for (depth = JSON_PARSE_DEPTH - 2; depth <= JSON_PARSE_DEPTH; depth++) {
+		size_t length;
+		char *js = deep_array(depth, &length);
+		int r = startParsingJSONn(&whole, js, length);
+		CHECK(r == ((depth < JSON_PARSE_DEPTH) ? JSON_ERROR_OK : JSON_ERROR_STACK_FULL));
+		CHECK(parseParallelJSON(&batch, &parser, js, length) == r);
+		if (r == JSON_ERROR_OK) {
+			check_tokens(&parser, &whole);
+		}
+		endParsingJSON(&parser);
+		endParsingJSON(&whole);
+		free(js);
+	}
+	freeParsingJSON(&parser);
+	freeParsingJSON(&whole);
+	freeBatchJSON(&batch);
+}
+
+/* An object of keys k0, k1, ... with the numbers as values */
+static char *keys_object(int count) {
+	char *js = malloc(count * 24 + 16), *p = js;
+	int i;
+
+	*p++ = '{';
+	for (i = 0; i < count; i++) {
+		p += sprintf(p, "%s\"k%d\":%d", (i > 0) ? "," : "", i, i);
+	}
+	strcpy(p, "}");
+	return js;
+}
+
+/* All keys are found, absent ones are not */
+static void check_keys(parser_s *parser, int count) {
+	char key[16];
+	int i;
+
+	for (i = 0; i < count; i++) {
+		strview_s view;
+		sprintf(key, "k%d", i);
+		view = tokenAtToView(parser, findKey(parser, 0, key));
+		CHECK(view.length == strlen(key + 1) && memcmp(view.string, key + 1, view.length) == 0);
+	}
+	sprintf(key, "k%d", count);
+	CHECK(findKey(parser, 0, key) == -1 && findKey(parser, 0, "") == -1 && findKey(parser, 0, "k") == -1);
+}
+
+/* Objects from JSON_KEY_INDEX_MIN keys on are indexed, lazy ones once scanned */
+static void test_key_index(void) {
+	parser_s parser;
+	char key[16];
+	int count, lazy;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	for (count = JSON_KEY_INDEX_MIN - 1; count <= JSON_KEY_INDEX_MIN + 1; count++) {
+		char *js = keys_object(count);
+		for (lazy = 0; lazy < 2; lazy++) {
+			if (lazy) {
+				CHECK(startParsingJSONLazy(&parser, js, strlen(js)) == JSON_ERROR_OK);
+			} else {
+				CHECK(startParsingJSONn(&parser, js, strlen(js)) == JSON_ERROR_OK);
+			}
+			sprintf(key, "k%d", count - 1);
+			CHECK(findKey(&parser, 0, key) > 0);
+			CHECK(parser.keyIndexUsed == ((count < JSON_KEY_INDEX_MIN) ? 0 : (size_t) count + 1));
+			check_keys(&parser, count);
+			CHECK(parser.keyIndexUsed == ((count < JSON_KEY_INDEX_MIN) ? 0 : (size_t) count + 1));
+			endParsingJSON(&parser);
+		}
+		free(js);
+	}
+	freeParsingJSON(&parser);
+}
+
+static bool fail_growth;
+
+static void *failing_realloc(void *ctx, void *ptr, size_t oldSize, size_t newSize) {
+	if (fail_growth && newSize > 0) {
+		return NULL;
+	}
+	return reallocJSON(ctx, ptr, oldSize, newSize);
+}
+
+/* A frozen parse has the index of every large object and writes nothing */
+static void test_freeze(void) {
+	char *js = keys_object(40);
+	parser_s parser;
+	int lazy;
+
+	for (lazy = 0; lazy < 2; lazy++) {
+		initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+		if (lazy) {
+			CHECK(startParsingJSONLazy(&parser, js, strlen(js)) == JSON_ERROR_OK);
+		} else {
+			CHECK(startParsingJSONn(&parser, js, strlen(js)) == JSON_ERROR_OK);
+		}
+		CHECK(freezeParsingJSON(&parser) == JSON_ERROR_OK);
+		CHECK(parser.keyIndexUsed == 41);
+		check_keys(&parser, 40);
+		CHECK(parser.keyIndexUsed == 41);
+		freeParsingJSON(&parser);
+	}
+
+	/* Without memory for the index the keys are searched one by one */
+	initParsingJSON(&parser, NULL, 0, failing_realloc, NULL);
+	CHECK(startParsingJSONn(&parser, js, strlen(js)) == JSON_ERROR_OK);
+	fail_growth = true;
+	CHECK(freezeParsingJSON(&parser) == JSON_ERROR_NOMEM);
+	fail_growth = false;
+	check_keys(&parser, 40);
+	CHECK(parser.keyIndexUsed == 0 && parser.keyIndex == NULL);
+	freeParsingJSON(&parser);
+	free(js);
+}
+
+/* Lengths beyond int fail before any byte is read */
+static void test_too_large(void) {
+	#ifndef JSON_LARGE_DOCUMENTS
+	static const char js[] = "[]";
+	size_t len = (size_t) INT_MAX;
+	parser_s parser;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONn(&parser, js, len) == JSON_ERROR_TOO_LARGE);
+	endParsingJSON(&parser);
+	CHECK(startParsingJSONn(&parser, js, len + 1) == JSON_ERROR_TOO_LARGE);
+	endParsingJSON(&parser);
+	CHECK(startParsingJSONLazy(&parser, js, len) == JSON_ERROR_TOO_LARGE);
+	endParsingJSON(&parser);
+	CHECK(feedParsingJSON(&parser, js, len) == JSON_ERROR_TOO_LARGE);
+	endParsingJSON(&parser);
+	CHECK(startParsingJSONn(&parser, js, sizeof(js) - 1) == JSON_ERROR_OK);
+	endParsingJSON(&parser);
+	freeParsingJSON(&parser);
+	#endif
+}
+
+/* Raw control characters are only allowed outside of strings */
+static void test_valid(void) {
+	static const char *valid[] = {
+		"\"\"", "\"\\u0001\\t\"", "\"\x7f\xc3\xa9\xff\"", " [ \"a\" ,\n\t{ } ]\r\n",
+		"{\"0123456789abcdef0123456789\":\"0123456789abcdef0123456789\"}"
+	};
+	static const char *invalid[] = {
+		"\"\x01\"", "\"a\tb\"", "[\"\n\"]", "{\"k\x1f\":1}", "\"0123456789abcdef\x0a\"",
+		"\"0123456789abcdef0123456789abcde\x1f\"", "{\"a\":1,}", "[1 2]"
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+		CHECK(isValidJSON(valid[i], strlen(valid[i])));
+	}
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		CHECK(!isValidJSON(invalid[i], strlen(invalid[i])));
+	}
+	/* A NUL byte inside of the length */
+	CHECK(!isValidJSON("\"a\0b\"", 5));
+}
+
+/* nextSibling() and skipToken() step over whole values at any depth */
+static void test_siblings(void) {
+	static const char js[] = "{\"a\":{\"x\":[1,[2,3]]},\"b\":[[4],{\"y\":5},6],\"c\":7}";
+	parser_s parser;
+	int lazy, n;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	for (lazy = 0; lazy < 2; lazy++) {
+		if (lazy) {
+			CHECK(startParsingJSONLazy(&parser, js, strlen(js)) == JSON_ERROR_OK);
+		} else {
+			CHECK(startParsingJSONn(&parser, js, strlen(js)) == JSON_ERROR_OK);
+		}
+		/* The keys of the root */
+		nextToken(&parser);
+		CHECK(tokenEqualString(&parser, "a"));
+		CHECK(nextSibling(&parser) && tokenEqualString(&parser, "b"));
+		CHECK(nextSibling(&parser) && tokenEqualString(&parser, "c"));
+		CHECK(!nextSibling(&parser) && tokenEqualString(&parser, "c"));
+
+		/* Into the value of "a" and its array */
+		parser.counter = 1;
+		nextToken(&parser);
+		CHECK(currentTokenType(&parser) == JSON_OBJECT);
+		nextToken(&parser);
+		CHECK(tokenEqualString(&parser, "x") && !nextSibling(&parser));
+		nextToken(&parser);
+		nextToken(&parser);
+		CHECK(tokenEqualString(&parser, "1"));
+		CHECK(nextSibling(&parser) && currentTokenType(&parser) == JSON_ARRAY);
+		CHECK(!nextSibling(&parser));
+		/* Behind the value of "a" to the key "b" */
+		skipToken(&parser);
+		CHECK(tokenEqualString(&parser, "b"));
+
+		/* The elements of "b" */
+		nextToken(&parser);
+		nextToken(&parser);
+		n = 1;
+		while (nextSibling(&parser)) {
+			n++;
+		}
+		CHECK(n == 3 && tokenEqualString(&parser, "6"));
+		nextToken(&parser);
+		CHECK(tokenEqualString(&parser, "c"));
+
+		/* A key is skipped with its value, the root with everything */
+		parser.counter = 1;
+		skipToken(&parser);
+		CHECK(tokenEqualString(&parser, "b"));
+		parser.counter = 0;
+		skipToken(&parser);
+		CHECK(!hasCurrentToken(&parser) && !nextSibling(&parser));
+		/* sizeOfTokens() tokenizes what a lazy parse skipped, with new indexes */
+		CHECK(lazy || parser.counter == sizeOfTokens(&parser));
+		endParsingJSON(&parser);
+	}
+	freeParsingJSON(&parser);
+}
+
+/* Events of parseSAXJSON() written one after the other, up to a limit */
+typedef struct {
+	char events[256];
+	size_t length;
+	int limit;
+} sax_log_s;
+
+static int sax_event(void *ctx, const char *event, const char *value, size_t length) {
+	sax_log_s *log = ctx;
+	size_t size = strlen(event);
+
+	if (log->limit-- == 0) {
+		return 1;
+	}
+	memcpy(log->events + log->length, event, size);
+	memcpy(log->events + log->length + size, value, length);
+	log->length += size + length;
+	log->events[log->length++] = ' ';
+	log->events[log->length] = '\0';
+	return 0;
+}
+
+static int sax_object_start(void *ctx) {
+	return sax_event(ctx, "{", "", 0);
+}
+
+static int sax_object_end(void *ctx) {
+	return sax_event(ctx, "}", "", 0);
+}
+
+static int sax_array_start(void *ctx) {
+	return sax_event(ctx, "[", "", 0);
+}
+
+static int sax_array_end(void *ctx) {
+	return sax_event(ctx, "]", "", 0);
+}
+
+static int sax_key(void *ctx, const char *key, size_t length) {
+	return sax_event(ctx, "k:", key, length);
+}
+
+static int sax_string(void *ctx, const char *value, size_t length) {
+	return sax_event(ctx, "s:", value, length);
+}
+
+static int sax_number(void *ctx, const char *value, size_t length) {
+	return sax_event(ctx, "n:", value, length);
+}
+
+static int sax_boolean(void *ctx, bool value) {
+	return sax_event(ctx, value ? "true" : "false", "", 0);
+}
+
+static int sax_null(void *ctx) {
+	return sax_event(ctx, "null", "", 0);
+}
+
+static int sax_run(const char *js, int limit, sax_log_s *log) {
+	static const sax_s sax = {
+		sax_object_start, sax_object_end, sax_array_start, sax_array_end,
+		sax_key, sax_string, sax_number, sax_boolean, sax_null
+	};
+	log->length = 0;
+	log->events[0] = '\0';
+	log->limit = limit;
+	return parseSAXJSON(&sax, log, js, strlen(js));
+}
+
+/* Callbacks in document order, a non-zero result stops the parse at once */
+static void test_sax(void) {
+	static const char js[] = " {\"a\":[1,-2.5e3,{}],\"b\\\"\":\"x\\n\",\"c\":[true,false,null,[]]} ";
+	static const char events[] = "{ k:a [ n:1 n:-2.5e3 { } ] k:b\\\" s:x\\n k:c [ true false null [ ] ] } ";
+	static const sax_s none = { 0 };
+	sax_log_s log;
+
+	CHECK(sax_run(js, -1, &log) == JSON_ERROR_OK);
+	CHECK(strcmp(log.events, events) == 0);
+	CHECK(sax_run(js, 4, &log) == JSON_ERROR_ABORTED);
+	CHECK(strcmp(log.events, "{ k:a [ n:1 ") == 0);
+	CHECK(sax_run(js, 0, &log) == JSON_ERROR_ABORTED && log.length == 0);
+	CHECK(parseSAXJSON(&none, NULL, js, strlen(js)) == JSON_ERROR_OK);
+
+	/* Errors are found while the callbacks run */
+	CHECK(sax_run("[1,[2", -1, &log) == JSON_ERROR_PART);
+	CHECK(strcmp(log.events, "[ n:1 [ n:2 ") == 0);
+	CHECK(sax_run("[1,]", -1, &log) == JSON_ERROR_INVAL);
+	CHECK(sax_run("{\"a\" 1}", -1, &log) == JSON_ERROR_INVAL);
+	CHECK(sax_run("1 2", -1, &log) == JSON_ERROR_INVAL);
+}
+
+int main(void) {
+	size_t i;
+
+	for (i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+		test_feed(documents[i]);
+	}
+	test_feed_primitive();
+	test_lazy();
+	test_parallel_depth();
+	test_too_large();
+	test_key_index();
+	test_freeze();
+	test_valid();
+	test_sax();
+	test_siblings();
+	return TEST_RESULT;
+}
@@ -0,0 +1,99 @@
+/*
+ * Parsed values copied and reformatted into an unparser.
+ */
+#include <string.h>
+
+#include "aiko-json.h"
+#include "test.h"
+
+static const char *source = "{ \"id\" : 17, \"drop\" : [1, 2],\n"
+		"  \"price\" : 1.25, \"nested\" : { \"a\" : [ true, null, \"x\\\"y\" ], \"e\" : { } } }";
+
+static int patch(void *ctx, unparser_s *unparser, parser_s *parser, size_t key) {
+	strview_s name = tokenAtToView(parser, key);
+	(void) ctx;
+	if (name.length == 4 && memcmp(name.string, "drop", 4) == 0) {
+		return JSON_TRANSCODE_SKIP;
+	}
+	if (name.length == 5 && memcmp(name.string, "price", 5) == 0) {
+		addDoubleToObject(unparser, "price", 9.5);
+		return JSON_TRANSCODE_SKIP;
+	}
+	if (name.length == 2 && memcmp(name.string, "id", 2) == 0) {
+		addStringToObject(unparser, "inserted", "yes");
+	}
+	return JSON_TRANSCODE_KEEP;
+}
+
+static void transcode(bool lazy, int reformat, djson_format_e format, const char *expected) {
+	parser_s parser;
+	unparser_s unparser;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	if (lazy) {
+		CHECK(startParsingJSONLazy(&parser, source, strlen(source)) == JSON_ERROR_OK);
+	} else {
+		CHECK(startParsingJSONn(&parser, source, strlen(source)) == JSON_ERROR_OK);
+	}
+	initUnparsingJSON(&unparser, NULL, 0, reallocJSON, NULL);
+	startUnparsingJSON(&unparser, JSON_OBJECT, format);
+	CHECK(transcodeJSON(&unparser, &parser, 0, reformat, patch, NULL) == JSON_ERROR_OK);
+	addBooleanToObject(&unparser, "patched", 1);
+	CHECK(endJSON(&unparser) == JSON_ERROR_OK);
+	CHECK(strcmp(getJSON(&unparser), expected) == 0);
+	if (strcmp(getJSON(&unparser), expected) != 0) {
+		fprintf(stderr, "%s\n", getJSON(&unparser));
+	}
+	freeUnparsingJSON(&unparser);
+	endParsingJSON(&parser);
+	freeParsingJSON(&parser);
+}
+
+static void test_transcode(void) {
+	int lazy;
+
+	for (lazy = 0; lazy < 2; lazy++) {
+		transcode(lazy, 0, JSON_COMPACT, "{\"inserted\":\"yes\",\"id\":17,\"price\":9.5,"
+				"\"nested\":{ \"a\" : [ true, null, \"x\\\"y\" ], \"e\" : { } },\"patched\":true}");
+		transcode(lazy, 1, JSON_COMPACT, "{\"inserted\":\"yes\",\"id\":17,\"price\":9.5,"
+				"\"nested\":{\"a\":[true,null,\"x\\\"y\"],\"e\":{}},\"patched\":true}");
+		transcode(lazy, 1, JSON_PRETTY, "{\n    \"inserted\": \"yes\",\n    \"id\": 17,\n    \"price\": 9.5,\n"
+				"    \"nested\": {\n        \"a\": [\n            true,\n            null,\n            \"x\\\"y\"\n        ],\n"
+				"        \"e\": {}\n    },\n    \"patched\": true\n}");
+	}
+}
+
+/* Values a lazy parse skipped were only bracket matched, not validated */
+static void test_unvalidated(void) {
+	static const char js[] = "{\"a\":{\"x\":[1,\001]},\"b\":2}";
+	parser_s parser;
+	unparser_s unparser;
+	json_offset_t a;
+
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONLazy(&parser, js, sizeof(js) - 1) == JSON_ERROR_OK);
+	CHECK(findKey(&parser, 0, "b") > 0);
+	a = findKey(&parser, 0, "a");
+	CHECK(a > 0);
+
+	initUnparsingJSON(&unparser, NULL, 0, reallocJSON, NULL);
+	startUnparsingJSON(&unparser, JSON_OBJECT, JSON_COMPACT);
+	addFormattedTokenToObject(&unparser, "a", &parser, (size_t) a);
+	CHECK(unparser.error == JSON_ERROR_INVAL);
+	CHECK(endJSON(&unparser) == JSON_ERROR_INVAL);
+	freeUnparsingJSON(&unparser);
+
+	initUnparsingJSON(&unparser, NULL, 0, reallocJSON, NULL);
+	startUnparsingJSON(&unparser, JSON_OBJECT, JSON_PRETTY);
+	CHECK(transcodeJSON(&unparser, &parser, 0, 1, NULL, NULL) == JSON_ERROR_INVAL);
+	freeUnparsingJSON(&unparser);
+
+	endParsingJSON(&parser);
+	freeParsingJSON(&parser);
+}
+
+int main(void) {
+	test_transcode();
+	test_unvalidated();
+	return TEST_RESULT;
+}
@@ -0,0 +1,290 @@
+/*
+ * The unparser writes the same JSON into growing, flushed and fixed buffers
+ * of any size, and fills a fixed buffer which is too small up to its end.
+ * Non-ASCII characters may be written as \u escapes. A pooled unparser
+ * released while writing is reset.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "aiko-json.h"
+#include "test.h"
+
+typedef struct {
+	char *data;
+	size_t length;
+	int fail;							// fail the flush with this number
+} sink_t;
+
+static int flush_to_sink(void *ctx, const char *data, size_t len) {
+	sink_t *sink = ctx;
+	if (sink->fail > 0 && --sink->fail == 0) {
+		return 1;
+	}
+	sink->data = realloc(sink->data, sink->length + len);
+	memcpy(sink->data + sink->length, data, len);
+	sink->length += len;
+	return 0;
+}
+
+/* Uses every writer once */
+static int write_document(unparser_s *unparser, djson_format_e format) {
+	static const char *keys[] = { "id", "name", "tags" };
+	static const int ints[] = { 1, -22, 333 };
+	static const double doubles[] = { 0.5, -1e300, 3.0 };
+	static const bool bools[] = { true, false };
+	strview_s strings[2];
+	node_s tags[2];
+	node_s values[3];
+	shape_s shape;
+
+	strings[0].string = "plain";
+	strings[0].length = 5;
+	strings[1].string = "esc\"aped\n\xc3\xa9";
+	strings[1].length = 12;
+	memset(values, 0, sizeof(values));
+	memset(tags, 0, sizeof(tags));
+	values[0].type = JSON_NODE_INTEGER;
+	values[0].value.integer = -9007199254740993LL;
+	values[1].type = JSON_NODE_STRING;
+	values[1].value.string = "shaped \\ value";
+	values[1].count = 14;
+	values[2].type = JSON_NODE_ARRAY;
+	values[2].count = 2;
+	values[2].value.children = tags;
+	tags[0].type = JSON_NODE_BOOLEAN;
+	tags[0].value.boolean = true;
+	tags[1].type = JSON_NODE_NUMBER;
+	tags[1].value.number = 0.1;
+	CHECK(compileShape(&shape, keys, 3) == JSON_ERROR_OK);
+
+	startUnparsingJSON(unparser, JSON_OBJECT, format);
+	addStringToObject(unparser, "string", "a \"quoted\" string\twith escapes");
+	addStringToObjectN(unparser, "n", 1, "abcdef", 3);
+	addIntegerToObject(unparser, "int", -2147483647);
+	addInt64ToObject(unparser, "int64", INT64_MIN);
+	addUInt64ToObject(unparser, "uint64", UINT64_MAX);
+	addDoubleToObject(unparser, "double", 2.718281828459045);
+	addFixedDoubleToObject(unparser, "fixed", 2.5, 3);
+	addBooleanToObject(unparser, "bool", 1);
+	addNullToObject(unparser, "null");
+	addRawTextToObject(unparser, "raw", "{\"r\":1}");
+	addObjectToObject(unparser, "object");
+	addObjectToObject(unparser, "empty");
+	endObject(unparser);
+	addArrayToObject(unparser, "array");
+	addStringToArray(unparser, "element");
+	addIntegerToArray(unparser, 7);
+	addDoubleToArray(unparser, 1e-9);
+	addNullToArray(unparser);
+	addObjectToArray(unparser);
+	endObject(unparser);
+	endArray(unparser);
+	endObject(unparser);
+	addIntegerArrayToObject(unparser, "ints", ints, 3);
+	addDoubleArrayToObject(unparser, "doubles", doubles, 3);
+	addBooleanArrayToObject(unparser, "bools", bools, 2);
+	addStringArrayToObject(unparser, "strings", strings, 2);
+	addInt64ArrayToObject(unparser, "none", NULL, 0);
+	addShapedToObject(unparser, "shaped", &shape, values);
+	addArrayToObject(unparser, "records");
+	addShapedToArray(unparser, &shape, values);
+	addShapedToArray(unparser, &shape, values);
+	endArray(unparser);
+	return endJSON(unparser);
+}
+
+static void test_buffers(djson_format_e format) {
+	unparser_s unparser;
+	sink_t sink;
+	char *expected;
+	size_t length, size;
+
+	initUnparsingJSON(&unparser, NULL, 0, reallocJSON, NULL);
+	CHECK(write_document(&unparser, format) == JSON_ERROR_OK);
+	length = getJSONSize(&unparser);
+	expected = malloc(length + 1);
+	memcpy(expected, getJSON(&unparser), length + 1);
+	CHECK(expected[length] == '\0');
+	freeUnparsingJSON(&unparser);
+
+	/* Fixed buffers need one byte for the terminator */
+	for (size = 1; size <= length + 2; size++) {
+		char *buffer = malloc(size);
+		int r;
+		initUnparsingJSON(&unparser, buffer, size, NULL, NULL);
+		r = write_document(&unparser, format);
+		if (size > length) {
+			CHECK(r == JSON_ERROR_OK);
+			CHECK(getJSONSize(&unparser) == length);
+			CHECK(memcmp(buffer, expected, length + 1) == 0);
+		} else {
+			CHECK(r == JSON_ERROR_BUF_FULL);
+			CHECK(getJSONSize(&unparser) == ((size < length) ? size : length));
+			CHECK(memcmp(buffer, expected, getJSONSize(&unparser)) == 0);
+		}
+		freeUnparsingJSON(&unparser);
+		free(buffer);
+	}
+
+	/* Flushed buffers of any size */
+	for (size = 1; size <= length + 2; size++) {
+		char *buffer = malloc(size);
+		memset(&sink, 0, sizeof(sink));
+		initUnparsingJSON(&unparser, buffer, size, NULL, NULL);
+		setUnparsingFlush(&unparser, flush_to_sink, &sink);
+		CHECK(write_document(&unparser, format) == JSON_ERROR_OK);
+		CHECK(sink.length == length);
+		CHECK(sink.data != NULL && sink.length == length && memcmp(sink.data, expected, length) == 0);
+		freeUnparsingJSON(&unparser);
+		free(sink.data);
+		free(buffer);
+	}
+
+	/* A failing flush stops the output */
+	memset(&sink, 0, sizeof(sink));
+	sink.fail = 2;
+	{
+		char buffer[16];
+		initUnparsingJSON(&unparser, buffer, sizeof(buffer), NULL, NULL);
+		setUnparsingFlush(&unparser, flush_to_sink, &sink);
+		CHECK(write_document(&unparser, format) == JSON_ERROR_FLUSH);
+		CHECK(sink.length > 0 && sink.length <= sizeof(buffer));
+		CHECK(sink.data != NULL && memcmp(sink.data, expected, sink.length) == 0);
+		freeUnparsingJSON(&unparser);
+		free(sink.data);
+	}
+	free(expected);
+}
+
+/* Non-ASCII characters as \\u escapes, beyond U+FFFF as surrogate pairs */
+static void test_escape_unicode(void) {
+	static const char *strings[] = {
+		"a\xc3\xa9\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf", "\"\x01\x7f",
+		"\xff\xc0\xaf\xed\xa0\x80", "\xf0\x9f\x98"
+	};
+	static const char expected[] = "[\"a\\u00e9\\u20ac\",\"\\ud83d\\ude00\",\"\\udbff\\udfff\",\"\\\"\\u0001\x7f\","
+			"\"\\ufffd\\ufffd\\ufffd\\ufffd\\ufffd\\ufffd\",\"\\ufffd\\ufffd\\ufffd\"]";
+	size_t count = sizeof(strings) / sizeof(strings[0]), i;
+	unparser_s unparser;
+	parser_s parser;
+	arena_s arena;
+	node_s *root;
+
+	initUnparsingJSON(&unparser, NULL, 0, reallocJSON, NULL);
+	setUnparsingEscapeUnicode(&unparser, 1);
+	startUnparsingJSON(&unparser, JSON_ARRAY, JSON_COMPACT);
+	for (i = 0; i < count; i++) {
+		addStringToArrayN(&unparser, strings[i], strlen(strings[i]));
+	}
+	CHECK(endJSON(&unparser) == JSON_ERROR_OK);
+	CHECK(strcmp(getJSON(&unparser), expected) == 0);
+
+	/* The escapes decode to the valid strings again */
+	initParsingJSON(&parser, NULL, 0, reallocJSON, NULL);
+	initArenaJSON(&arena, NULL, 0, reallocJSON, NULL);
+	CHECK(startParsingJSONn(&parser, getJSON(&unparser), getJSONSize(&unparser)) == JSON_ERROR_OK);
+	CHECK(buildDOM(&parser, &arena, &root) == JSON_ERROR_OK && root->count == count);
+	for (i = 0; i < 4; i++) {
+		CHECK(strcmp(root->value.children[i].value.string, strings[i]) == 0);
+	}
+	freeArenaJSON(&arena);
+	freeParsingJSON(&parser);
+	endUnparsingJSON(&unparser);
+
+	/* Without the setting UTF-8 is copied */
+	setUnparsingEscapeUnicode(&unparser, 0);
+	startUnparsingJSON(&unparser, JSON_ARRAY, JSON_COMPACT);
+	addStringToArrayN(&unparser, strings[1], strlen(strings[1]));
+	CHECK(endJSON(&unparser) == JSON_ERROR_OK);
+	CHECK(strcmp(getJSON(&unparser), "[\"\xf0\x9f\x98\x80\"]") == 0);
+	freeUnparsingJSON(&unparser);
+}
+
+/* An unparser released in the middle of a JSON is clean for the next user */
+static void test_pool(void) {
+	static pool_s pool;
+	unparser_s *unparser;
+
+	initPoolJSON(&pool, reallocJSON, NULL);
+	unparser = acquireUnparser(&pool);
+	CHECK(unparser != NULL);
+	startUnparsingJSON(unparser, JSON_OBJECT, JSON_PRETTY);
+	addObjectToObject(unparser, "open");
+	addIntegerToObject(unparser, "a", 1);
+	releaseUnparser(&pool, unparser);
+
+	unparser = acquireUnparser(&pool);
+	CHECK(unparser != NULL && !unparser->isUnparsing);
+	startUnparsingJSON(unparser, JSON_OBJECT, JSON_COMPACT);
+	addIntegerToObject(unparser, "b", 2);
+	CHECK(endJSON(unparser) == JSON_ERROR_OK);
+	CHECK(strcmp(getJSON(unparser), "{\"b\":2}") == 0);
+	endUnparsingJSON(unparser);
+	releaseUnparser(&pool, unparser);
+	freePoolJSON(&pool);
+}
+
+/* All members of a pool can be taken, a released one is the next to go */
+static void test_pool_exhaustion(void) {
+	static pool_s pool;
+	parser_s *parsers[JSON_POOL_SIZE], *parser;
+	unparser_s *unparsers[JSON_POOL_SIZE], *unparser;
+	token_s *tokens;
+	char *buffer;
+	int i, j;
+
+	initPoolJSON(&pool, reallocJSON, NULL);
+	for (i = 0; i < JSON_POOL_SIZE; i++) {
+		parsers[i] = acquireParser(&pool);
+		unparsers[i] = acquireUnparser(&pool);
+		CHECK(parsers[i] != NULL && unparsers[i] != NULL);
+		for (j = 0; j < i; j++) {
+			CHECK(parsers[j] != parsers[i] && unparsers[j] != unparsers[i]);
+		}
+	}
+	CHECK(acquireParser(&pool) == NULL && acquireUnparser(&pool) == NULL);
+
+	/* A parser released while parsing keeps its tokens */
+	parser = parsers[JSON_POOL_SIZE / 2];
+	CHECK(startParsingJSONn(parser, "[1,2,3]", 7) == JSON_ERROR_OK);
+	tokens = parser->tokens;
+	releaseParser(&pool, parser);
+	CHECK(acquireParser(&pool) == parser && acquireParser(&pool) == NULL);
+	CHECK(!parser->isParsing && parser->tokens == tokens);
+	CHECK(startParsingJSONn(parser, "{\"a\":1}", 7) == JSON_ERROR_OK && sizeOfTokens(parser) == 3);
+	endParsingJSON(parser);
+
+	/* An unparser keeps its buffer, not its settings */
+	unparser = unparsers[0];
+	setUnparsingEscapeUnicode(unparser, 1);
+	startUnparsingJSON(unparser, JSON_ARRAY, JSON_COMPACT);
+	addStringToArray(unparser, "\xc3\xa9");
+	CHECK(endJSON(unparser) == JSON_ERROR_OK);
+	buffer = unparser->buffer;
+	releaseUnparser(&pool, unparser);
+	CHECK(acquireUnparser(&pool) == unparser && acquireUnparser(&pool) == NULL);
+	CHECK(unparser->buffer == buffer && unparser->escapeUnicode == 0 && unparser->flush == NULL);
+	startUnparsingJSON(unparser, JSON_ARRAY, JSON_COMPACT);
+	addStringToArray(unparser, "\xc3\xa9");
+	CHECK(endJSON(unparser) == JSON_ERROR_OK && strcmp(getJSON(unparser), "[\"\xc3\xa9\"]") == 0);
+	endUnparsingJSON(unparser);
+
+	for (i = 0; i < JSON_POOL_SIZE; i++) {
+		releaseParser(&pool, parsers[i]);
+		releaseUnparser(&pool, unparsers[i]);
+	}
+	CHECK(acquireParser(&pool) == parsers[0] && acquireUnparser(&pool) == unparsers[0]);
+	releaseParser(&pool, parsers[0]);
+	releaseUnparser(&pool, unparsers[0]);
+	freePoolJSON(&pool);
+}
+
+int main(void) {
+	test_buffers(JSON_COMPACT);
+	test_buffers(JSON_PRETTY);
+	test_escape_unicode();
+	test_pool();
+	test_pool_exhaustion();
+	return TEST_RESULT;
+}
@@ -0,0 +1,21 @@
+/*
+ * Checks of the tests: CHECK() reports a failed condition and counts it,
+ * main() returns TEST_RESULT.
+ */
+#ifndef __AIKO_JSON_TEST__
+#define __AIKO_JSON_TEST__
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+			test_failures++; \
+		} \
+	} while (0)
+
+#define TEST_RESULT ((test_failures == 0) ? 0 : 1)
+
+#endif